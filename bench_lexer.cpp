@@ -0,0 +1,130 @@
+#include "graphql-cpp.hpp"
+
+#include <malloc.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include <fmt/core.h>
+
+using namespace graphql;
+
+// Compares the linked Token list with the packed TokenBuffer on a large generated document:
+// heap bytes still held per token after lexing, allocations per token and scan throughput. Also
+// reports UTF-8 validation throughput on ASCII and on mostly non-ASCII text, and how lexing with
+// recovery scales with the number of errors.
+//
+//   g++ -std=c++17 -O2 -I. bench_lexer.cpp -lfmt -o bench_lexer && ./bench_lexer
+
+size_t live_bytes = 0;
+size_t allocation_count = 0;
+
+void *operator new(size_t size) {
+    void *pointer = std::malloc(size);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+    live_bytes += malloc_usable_size(pointer);
+    allocation_count += 1;
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+    if (pointer != nullptr)
+        live_bytes -= malloc_usable_size(pointer);
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+std::string generate_document(int operations) {
+    std::string document;
+    for (int i = 0; i < operations; i++) {
+        document += fmt::format(
+                "# operation {}\n"
+                "query Operation{}($id: ID!, $first: Int = 10) {{\n"
+                "  user(id: $id) {{\n"
+                "    name\n"
+                "    friends(first: $first, after: \"cursor-{}\") {{\n"
+                "      edges {{ node {{ id name score(scale: 1.5e2) }} }}\n"
+                "      ...PageInfo\n"
+                "    }}\n"
+                "  }}\n"
+                "}}\n\n", i, i, i);
+    }
+    return document;
+}
+
+template <class F>
+void measure(std::string name, int body_length, F lex) {
+    size_t bytes_before = live_bytes;
+    size_t count_before = allocation_count;
+    auto started = std::chrono::steady_clock::now();
+    size_t tokens = lex();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    size_t bytes = live_bytes - bytes_before;
+    size_t count = allocation_count - count_before;
+    std::cout << fmt::format("{:<12} {:>9} tokens  {:>7.1f} bytes/token  {:>6.2f} allocations/token  {:>8.1f} MB/s",
+            name, tokens, static_cast<double>(bytes) / tokens, static_cast<double>(count) / tokens,
+            body_length / elapsed / 1e6) << std::endl;
+}
+
+void measure_validation(std::string name, const std::string &text) {
+    int rounds = 20;
+    int invalid = 0;
+    auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        invalid += find_invalid_utf8(text, i % 2, text.length());
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << fmt::format("{:<12} UTF-8 validation {:>8.2f} GB/s{}", name, text.length() * rounds / elapsed / 1e9,
+            invalid == -rounds ? "" : " (invalid input)") << std::endl;
+}
+
+void measure_recovery(int lines) {
+    std::string text;
+    for (int i = 0; i < lines; i++)
+        text += "{ field ? other }\n";
+    Source source(text);
+    auto started = std::chrono::steady_clock::now();
+    Lexer lexer(&source, true);
+    while (lexer.advance()->kind != TokenKind::EOF) { }
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    std::cout << fmt::format("{:<12} {:>6} errors  {:>8.2f} ms  {:>6.3f} us/error", "Recovery", lexer.errors.size(), elapsed,
+            elapsed * 1000 / lexer.errors.size()) << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int operations = argc > 1 ? std::atoi(argv[1]) : 20000;
+    Source *source = new Source(generate_document(operations));
+    int body_length = source->body().length();
+    std::cout << fmt::format("document: {} bytes", body_length) << std::endl;
+
+    measure("Token list", body_length, [&]() {
+        Lexer *lexer = new Lexer(source);
+        size_t tokens = 1;
+        while (lexer->advance()->kind != TokenKind::EOF)
+            tokens += 1;
+        return tokens;
+    });
+
+    measure("TokenBuffer", body_length, [&]() {
+        TokenBuffer *tokens = new TokenBuffer(source);
+        TokenCursor cursor(tokens);
+        size_t count = 1;
+        while (cursor.advance())
+            count += 1;
+        return count;
+    });
+
+    measure_validation("ASCII", source->body());
+    std::string text;
+    while (text.length() < source->body().length())
+        text += "\"gr\u00fc\u00dfe, \u4f60\u597d, \U0001F600\" ";
+    measure_validation("non-ASCII", text);
+
+    for (int lines = 1000; lines <= 64000; lines *= 4)
+        measure_recovery(lines);
+}
@@ -0,0 +1,116 @@
+#include "graphql-cpp.hpp"
+
+#include <malloc.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include <fmt/core.h>
+
+using namespace graphql;
+
+// Allocations per request for lexing and parsing a rotating set of queries, with a new Lexer or
+// Parser per request and with instances reused through LexerPool and ParserPool. Reused instances
+// are warmed up first, so the pooled numbers are the steady state. The last two rows compare
+// parsing and planning every request with fetching its prepared operation from a PlanCache;
+// both resolve the request's arguments. The cached row lexes each request into one reused
+// TokenBuffer, as a server thread would, and only makes a new one while a cached plan still
+// holds the last.
+//
+//   g++ -std=c++17 -O2 -I. bench_pool.cpp -lfmt -o bench_pool && ./bench_pool
+
+size_t allocation_count = 0;
+
+void *operator new(size_t size) {
+    void *pointer = std::malloc(size);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+    allocation_count += 1;
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+std::vector<Source *> generate_requests() {
+    std::vector<Source *> requests;
+    for (int i = 0; i < 8; i++) {
+        requests.push_back(new Source(fmt::format(
+                "query Request{0}($id: ID!, $first: Int = {0}) {{\n"
+                "  user(id: $id) {{\n"
+                "    name\n"
+                "    friends(first: $first, after: \"an opaque pagination cursor {0}\") {{\n"
+                "      edges {{ node {{ id name score(scale: 1.5e2) @include(if: true) }} }}\n"
+                "      ...PageInfo\n"
+                "    }}\n"
+                "  }}\n"
+                "}}\n"
+                "fragment PageInfo on FriendConnection {{ pageInfo {{ hasNextPage endCursor }} }}\n", i)));
+    }
+    return requests;
+}
+
+template <class F>
+void measure(std::string name, std::vector<Source *> &requests, F request) {
+    int warmup = 1000;
+    int rounds = 20000;
+    for (int i = 0; i < warmup; i++)
+        request(requests[i % requests.size()]);
+    size_t count_before = allocation_count;
+    auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        request(requests[i % requests.size()]);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << fmt::format("{:<14} {:>8.2f} allocations/request  {:>8.2f} us/request", name,
+            static_cast<double>(allocation_count - count_before) / rounds, elapsed / rounds * 1e6) << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<Source *> requests = generate_requests();
+
+    measure("Lexer new", requests, [](Source *source) {
+        Lexer *lexer = new Lexer(source);
+        while (lexer->advance()->kind != TokenKind::EOF);
+        delete lexer;
+    });
+
+    measure("Lexer pooled", requests, [](Source *source) {
+        Lexer *lexer = LexerPool::acquire(source);
+        while (lexer->advance()->kind != TokenKind::EOF);
+        LexerPool::release(lexer);
+    });
+
+    measure("Parser new", requests, [](Source *source) {
+        delete parse(source);
+    });
+
+    measure("Parser pooled", requests, [](Source *source) {
+        Parser *parser = ParserPool::acquire(source);
+        DocumentNode *document = parser->parse_document();
+        ParserPool::release(parser, document);
+    });
+
+    measure("Plan new", requests, [](Source *source) {
+        DocumentNode *document = parse(source);
+        document->argument_plan()->resolve({{"id", Value::string("1")}});
+        delete document;
+    });
+
+    PlanCache cache(16);
+    std::shared_ptr<TokenBuffer> tokens;
+    measure("Plan cached", requests, [&](Source *source) {
+        if (tokens && tokens.use_count() == 1)
+            tokens->reset(source);
+        else
+            tokens = std::make_shared<TokenBuffer>(source);
+        cache.prepare(tokens)->resolve(*tokens, {{"id", Value::string("1")}});
+    });
+    std::cout << fmt::format("plan cache hit rate {:.4f}", cache.stats().hit_rate()) << std::endl;
+}
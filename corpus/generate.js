@@ -0,0 +1,74 @@
+// Regenerates the expected token streams in corpus/lexer from the reference lexer, graphql-js
+// 15.8.0:
+//
+//   npm install --no-save graphql@15.8.0 && node corpus/generate.js
+//
+// Each <case>.graphql gets a <case>.tokens file with one line per token returned by
+// Lexer.advance(), or an "error <line> <column>" line for the first syntax error. graphql-js
+// counts positions in UTF-16 code units; the C++ lexer works on UTF-8 bytes, so offsets are
+// written as byte offsets and columns as code points.
+
+const fs = require('fs');
+const path = require('path');
+const { GraphQLError, Lexer, Source, TokenKind, version } = require('graphql');
+
+const REFERENCE_VERSION = '15.8.0';
+
+if (version !== REFERENCE_VERSION) {
+  console.error(`Expected graphql-js ${REFERENCE_VERSION}, found ${version}`);
+  process.exit(1);
+}
+
+const directory = path.join(__dirname, 'lexer');
+
+function byteOffset(body, position) {
+  return Buffer.byteLength(body.slice(0, position), 'utf8');
+}
+
+function codePointColumn(body, position, column) {
+  const lineStart = position - (column - 1);
+  return 1 + Array.from(body.slice(lineStart, position)).length;
+}
+
+function describeToken(body, token) {
+  let description = [
+    token.kind,
+    byteOffset(body, token.start),
+    byteOffset(body, token.end),
+    token.line,
+    codePointColumn(body, token.start, token.column),
+  ].join(' ');
+  if (token.value !== undefined) {
+    description += ' ' + JSON.stringify(token.value);
+  }
+  return description;
+}
+
+function lexLines(body) {
+  const lines = [];
+  const lexer = new Lexer(new Source(body));
+  try {
+    let token;
+    do {
+      token = lexer.advance();
+      lines.push(describeToken(body, token));
+    } while (token.kind !== TokenKind.EOF);
+  } catch (error) {
+    if (!(error instanceof GraphQLError)) {
+      throw error;
+    }
+    const location = error.locations[0];
+    const column = codePointColumn(body, error.positions[0], location.column);
+    lines.push(`error ${location.line} ${column}`);
+  }
+  return lines;
+}
+
+for (const file of fs.readdirSync(directory).sort()) {
+  if (path.extname(file) !== '.graphql') {
+    continue;
+  }
+  const body = fs.readFileSync(path.join(directory, file), 'utf8');
+  const output = path.join(directory, path.basename(file, '.graphql') + '.tokens');
+  fs.writeFileSync(output, lexLines(body).join('\n') + '\n');
+}
@@ -0,0 +1,67 @@
+#include "graphql-cpp.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+
+using namespace graphql;
+
+// libFuzzer target for the lexer. Build and run with clang, seeding from the differential corpus:
+//
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -fno-sanitize-recover=undefined -I. fuzz_lexer.cpp -lfmt -o fuzz_lexer
+//   ./fuzz_lexer -detect_leaks=0 corpus/lexer
+//
+// test_lexer_corpus.cpp builds the same way without -fsanitize=fuzzer to run the differential
+// test under ASan and UBSan. Leak detection is off because syntax errors do not free their
+// position lists yet.
+//
+// Every input is lexed twice: strict mode must either reach EOF or throw GraphQLSyntaxError, and
+// recovery mode must never throw and must report the strict error as its first one. Input that
+// lexes cleanly must also be valid UTF-8.
+
+void check(bool condition) {
+    if (!condition)
+        std::abort();
+}
+
+void check_token(Token *token, Token *prev, int body_length) {
+    check(token->start <= token->end);
+    check(token->end <= body_length);
+    check(token->start >= prev->end);
+    check(token->line >= prev->line);
+    check(token->column >= 1);
+}
+
+void lex_all(Lexer &lexer, int body_length) {
+    Token sof(TokenKind::SOF, 0, 0, 0, 0);
+    Token *prev = &sof;
+    do {
+        Token *token = lexer.advance();
+        check_token(token, prev, body_length);
+        prev = token;
+    } while (prev->kind != TokenKind::EOF);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    std::string body(reinterpret_cast<const char *>(data), size);
+    int body_length = body.length();
+    SourceLocation location_offset(1, 1);
+    Source source(body, "fuzz input", &location_offset);
+
+    int strict_error = -1;
+    try {
+        Lexer lexer(&source);
+        lex_all(lexer, body_length);
+        check(find_invalid_utf8(body, 0, body_length) == -1);
+    } catch (const GraphQLSyntaxError &e) {
+        strict_error = (*e.positions)[0];
+        check(strict_error >= 0 && strict_error <= body_length);
+    }
+
+    Lexer lexer(&source, true);
+    lex_all(lexer, body_length);
+    if (strict_error == -1)
+        check(lexer.errors.empty());
+    else
+        check(!lexer.errors.empty() && (*lexer.errors[0].positions)[0] == strict_error);
+    return 0;
+}
@@ -1,14 +1,37 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <memory>
+#include <optional>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <climits>
+#include <algorithm>
 #include <unordered_set>
 #include <map>
+#include <list>
 #include <vector>
 #include <sstream>
 #include <ostream>
 #include <iterator>
+#include <tuple>
+#include <typeinfo>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <fmt/core.h>
+#include <fmt/format.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #undef EOF
 
@@ -67,14 +90,185 @@ namespace graphql {
         return strings;
     }
 
+    // Splits on every line terminator: \r\n, \n and \r.
+    std::vector<std::string> split_lines(const std::string &str) {
+        std::vector<std::string> lines;
+        std::string::size_type prev = 0;
+        for (std::string::size_type pos = 0; pos < str.length(); pos++) {
+            if (str[pos] != '\n' && str[pos] != '\r')
+                continue;
+            lines.push_back(str.substr(prev, pos - prev));
+            if (str[pos] == '\r' && pos + 1 < str.length() && str[pos + 1] == '\n')
+                pos += 1;
+            prev = pos + 1;
+        }
+        lines.push_back(str.substr(prev));
+        return lines;
+    }
+
+    void append_utf8(std::string &value, int code_point) {
+        if (code_point < 0x80) {
+            value += static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            value += static_cast<char>(0xC0 | code_point >> 6);
+            value += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else if (code_point < 0x10000) {
+            value += static_cast<char>(0xE0 | code_point >> 12);
+            value += static_cast<char>(0x80 | (code_point >> 6 & 0x3F));
+            value += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else {
+            value += static_cast<char>(0xF0 | code_point >> 18);
+            value += static_cast<char>(0x80 | (code_point >> 12 & 0x3F));
+            value += static_cast<char>(0x80 | (code_point >> 6 & 0x3F));
+            value += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    // Length of the well-formed UTF-8 sequence starting at `position`, or 0 if the bytes there are
+    // not one (overlong forms, surrogates and code points above U+10FFFF are rejected).
+    int utf8_sequence_length(const std::string &body, int position) {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(body.data());
+        int body_length = body.length();
+        unsigned char lead = bytes[position];
+        if (lead < 0x80)
+            return 1;
+        int length;
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF)
+            length = 2;
+        else if (lead >= 0xE0 && lead <= 0xEF)
+            length = 3;
+        else if (lead >= 0xF0 && lead <= 0xF4)
+            length = 4;
+        else
+            return 0;
+        if (lead == 0xE0)
+            low = 0xA0;
+        else if (lead == 0xED)
+            high = 0x9F;
+        else if (lead == 0xF0)
+            low = 0x90;
+        else if (lead == 0xF4)
+            high = 0x8F;
+        if (position + length > body_length)
+            return 0;
+        if (bytes[position + 1] < low || bytes[position + 1] > high)
+            return 0;
+        for (int i = 2; i < length; i++)
+            if ((bytes[position + i] & 0xC0) != 0x80)
+                return 0;
+        return length;
+    }
+
+    // Number of leading bytes of [position, end) that are ASCII, checked 16 (or 8) bytes at a time.
+    int ascii_prefix_length(const std::string &body, int position, int end) {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(body.data());
+        int start = position;
+#if defined(__SSE2__)
+        while (position + 16 <= end && _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + position))) == 0)
+            position += 16;
+#else
+        while (position + 8 <= end) {
+            uint64_t word;
+            std::memcpy(&word, bytes + position, 8);
+            if (word & 0x8080808080808080ULL)
+                break;
+            position += 8;
+        }
+#endif
+        while (position < end && bytes[position] < 0x80)
+            position += 1;
+        return position - start;
+    }
+
+    // Offset of the first byte in [position, end) that does not start a well-formed UTF-8 sequence,
+    // or -1 when the whole range is valid.
+    int find_invalid_utf8(const std::string &body, int position, int end) {
+        while (position < end) {
+            position += ascii_prefix_length(body, position, end);
+            if (position >= end)
+                break;
+            int length = utf8_sequence_length(body, position);
+            if (length == 0)
+                return position;
+            position += length;
+        }
+        return -1;
+    }
+
+    int count_code_points(const std::string &body, int position, int end) {
+        int code_points = 0;
+        while (position < end) {
+            int ascii = ascii_prefix_length(body, position, end);
+            code_points += ascii;
+            position += ascii;
+            if (position >= end)
+                break;
+            if ((static_cast<unsigned char>(body[position]) & 0xC0) != 0x80)
+                code_points += 1;
+            position += 1;
+        }
+        return code_points;
+    }
+
+    // Adds the start of every line that follows a line terminator in [from, to). "\r\n", "\n" and
+    // a lone "\r" each end a line, as in the lexer.
+    void add_line_starts(const std::string &body, int from, int to, std::vector<uint32_t> &line_starts) {
+        int body_length = body.length();
+        for (int position = from; position < to; position++) {
+            if (body[position] == '\n' || (body[position] == '\r' && (position + 1 == body_length || body[position + 1] != '\n')))
+                line_starts.push_back(position + 1);
+        }
+    }
+
+    // Read-only view of part of a shared source buffer. Copies share the buffer through an atomic
+    // reference count, so a slice stays valid on any thread for as long as it is held.
+    class SourceSlice {
+        public:
+            std::shared_ptr<const std::string> buffer;
+            int start;
+            int end;
+
+            SourceSlice() {
+                this->start = 0;
+                this->end = 0;
+            }
+
+            SourceSlice(std::shared_ptr<const std::string> buffer, int start, int end) {
+                this->buffer = buffer;
+                this->start = start;
+                this->end = end;
+            }
+
+            std::string_view view() const {
+                if (this->buffer == nullptr)
+                    return std::string_view();
+                return std::string_view(*this->buffer).substr(this->start, this->end - this->start);
+            }
+
+            std::string str() const {
+                return std::string(this->view());
+            }
+
+            int length() const {
+                return this->end - this->start;
+            }
+    };
+
+    // The body lives in an immutable, reference-counted buffer. Copying a Source or slicing it
+    // never copies the text; edits install a new buffer and leave existing slices untouched.
     class Source {
         public:
-            std::string body;
+            std::shared_ptr<const std::string> buffer;
             std::string name;
             SourceLocation *location_offset;
 
-            Source(std::string body, std::string name = "GraphQL request", SourceLocation *location_offset = new SourceLocation(1, 1)) {
-                this->body = body;
+            Source(std::string body, std::string name = "GraphQL request", SourceLocation *location_offset = new SourceLocation(1, 1))
+                : Source(std::make_shared<const std::string>(std::move(body)), name, location_offset) { }
+
+            Source(std::shared_ptr<const std::string> buffer, std::string name = "GraphQL request", SourceLocation *location_offset = new SourceLocation(1, 1)) {
+                this->buffer = buffer;
                 this->name = name;
                 if (location_offset->line <= 0) {
                     throw std::invalid_argument("line in location_offset is 1-indexed and must be positive.");
@@ -85,32 +279,39 @@ namespace graphql {
                 this->location_offset = location_offset;
             }
 
-            SourceLocation get_location(int position) {
-                std::vector<std::string> lines = split_string(this->body.substr(0, position), "\n");
-                int line, column;
-                if (lines.size() > 0) {
-                    line = lines.size();
-                    column = lines.back().length() + 1;
-                } else {
-                    line = 1;
-                    column = 1;
-                }
-                return SourceLocation(line, column);
+            const std::string &body() const {
+                return *this->buffer;
+            }
+
+            SourceSlice slice(int start, int end) const {
+                return SourceSlice(this->buffer, start, end);
+            }
+
+            SourceLocation get_location(int position) const {
+                position = std::min(position, (int) this->body().length());
+                std::vector<uint32_t> line_starts{0};
+                add_line_starts(this->body(), 0, position, line_starts);
+                return SourceLocation(line_starts.size(), count_code_points(this->body(), line_starts.back(), position) + 1);
             }
     };
 
     class GraphQLError : public std::exception {
         public:
             std::string message;
-            std::vector<SourceLocation> *locations;
-            Source *source;
+            std::vector<SourceLocation> *locations = nullptr;
+            // A copy sharing the body, so errors outlive the parser or buffer that threw them.
+            std::shared_ptr<const Source> source;
             std::vector<int> *positions;
             std::exception *original_error;
+            SourceSlice body;
 
             GraphQLError(std::string message, Source *source = nullptr, std::vector<int> *positions = nullptr) {
                 this->message = message;
-                this->source = source;
+                if (source != nullptr)
+                    this->source = std::make_shared<const Source>(*source);
                 this->positions = positions;
+                if (source != nullptr)
+                    this->body = source->slice(0, source->body().length());
                 if (positions != nullptr && source != nullptr) {
                     std::vector<SourceLocation> *locations = new std::vector<SourceLocation>();
                     for (auto &position : *positions) {
@@ -120,6 +321,12 @@ namespace graphql {
                     this->locations = locations;
                 }
             }
+
+            // For callers that already know the location of the position.
+            GraphQLError(std::string message, Source *source, int position, SourceLocation location) : GraphQLError(message, source) {
+                this->positions = new std::vector<int>{position};
+                this->locations = new std::vector<SourceLocation>{location};
+            }
     };
 
     std::vector<int> *position_to_position_list(int position) {
@@ -132,6 +339,7 @@ namespace graphql {
         public:
             std::string description;
             GraphQLSyntaxError(Source *source, int position, std::string description) : GraphQLError(fmt::format("Syntax Error: {}", description), source, position_to_position_list(position)), description{description} { }
+            GraphQLSyntaxError(Source *source, int position, SourceLocation location, std::string description) : GraphQLError(fmt::format("Syntax Error: {}", description), source, position, location), description{description} { }
     };
 
     class Token {
@@ -176,6 +384,35 @@ namespace graphql {
         return true;
     }
 
+    std::map<TokenKind, std::string> token_kind_values {
+        {TokenKind::SOF, "<SOF>"},
+            {TokenKind::EOF, "<EOF>"},
+            {TokenKind::BANG, "!"},
+            {TokenKind::DOLLAR, "$"},
+            {TokenKind::AMP, "&"},
+            {TokenKind::PAREN_L, "("},
+            {TokenKind::PAREN_R, ")"},
+            {TokenKind::SPREAD, "..."},
+            {TokenKind::COLON, ":"},
+            {TokenKind::EQUALS, "="},
+            {TokenKind::AT, "@"},
+            {TokenKind::BRACKET_L, "["},
+            {TokenKind::BRACKET_R, "]"},
+            {TokenKind::BRACE_L, "{"},
+            {TokenKind::PIPE, "|"},
+            {TokenKind::BRACE_R, "}"},
+            {TokenKind::NAME, "Name"},
+            {TokenKind::INT, "Int"},
+            {TokenKind::FLOAT, "Float"},
+            {TokenKind::STRING, "String"},
+            {TokenKind::BLOCK_STRING, "BlockString"},
+            {TokenKind::COMMENT, "Comment"}
+    };
+
+    std::string token_kind_value(TokenKind kind) {
+        return token_kind_values.at(kind);
+    }
+
     std::unordered_set<TokenKind> punctuator_token_kinds {
         TokenKind::BANG,
             TokenKind::DOLLAR,
@@ -231,7 +468,14 @@ namespace graphql {
     }
 
     int uni_char_code(std::string str) {
-        return char2hex(str[0]) << 12 | char2hex(str[1]) << 8 | char2hex(str[2]) << 4 | char2hex(str[3]);
+        int code = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = char2hex(str[i]);
+            if (digit < 0)
+                return -1;
+            code = code << 4 | digit;
+        }
+        return code;
     }
 
     int leading_whitespace(std::string s) {
@@ -265,7 +509,7 @@ namespace graphql {
 
     bool is_blank_string(std::string s) {
         for (int i = 0; i < s.length(); i++)
-            if (!std::isspace(s[i]))
+            if (!std::isspace(static_cast<unsigned char>(s[i])))
                 return false;
         return true;
     }
@@ -300,7 +544,7 @@ namespace graphql {
         };
 
     std::string *dedent_block_string_value(std::string raw_string) {
-        std::vector<std::string> lines = split_string(raw_string, "\n");
+        std::vector<std::string> lines = split_lines(raw_string);
 
         int i = 0;
         bool trailing_culled = false;
@@ -322,8 +566,12 @@ namespace graphql {
                 i = 0;
             else
                 i = 1;
-            for (; i < lines.size(); i++)
-                lines[i] = lines[i].substr(common_indent, lines[i].length());
+            for (; i < lines.size(); i++) {
+                if (lines[i].length() > common_indent)
+                    lines[i] = lines[i].substr(common_indent, lines[i].length());
+                else
+                    lines[i] = "";
+            }
         }
 
         if (lines.size() > 0) {
@@ -355,16 +603,220 @@ namespace graphql {
     class Lexer {
         private:
             Source *source;
+            Token sof_token;
+            Token *sof;
             Token *token;
             Token *last_token;
             int line;
             int line_start;
+            bool recover;
+            bool materialize;
+            Token scratch;
+            Token scratch_prev;
+            std::string scratch_value;
+            int column_line_start;
+            int column_position;
+            int column_code_points;
+            // Tokens are carved out of fixed-size blocks and their values come from a pool of
+            // strings; reset() hands both out again from the start, so a reused lexer stops
+            // allocating once its buffers have grown to fit the requests it sees.
+            std::vector<std::vector<Token>> token_blocks;
+            size_t token_block;
+            std::vector<Token *> free_tokens;
+            std::vector<std::string *> values;
+            size_t values_used;
+            std::vector<std::string *> free_values;
+            // Token being read when each error was raised, so edits can tell which errors they redo.
+            std::vector<Token *> error_tokens;
+
+            Token *allocate_token(TokenKind kind, int start, int end, int line, int col, Token *prev, std::string *value) {
+                if (!this->free_tokens.empty()) {
+                    Token *token = this->free_tokens.back();
+                    this->free_tokens.pop_back();
+                    *token = Token(kind, start, end, line, col, prev, value);
+                    return token;
+                }
+                while (true) {
+                    if (this->token_block == this->token_blocks.size()) {
+                        this->token_blocks.emplace_back();
+                        this->token_blocks.back().reserve(256);
+                    }
+                    std::vector<Token> &block = this->token_blocks[this->token_block];
+                    if (block.size() < block.capacity()) {
+                        block.emplace_back(kind, start, end, line, col, prev, value);
+                        return &block.back();
+                    }
+                    this->token_block += 1;
+                }
+            }
+
+            std::string *allocate_value() {
+                if (!this->free_values.empty()) {
+                    std::string *value = this->free_values.back();
+                    this->free_values.pop_back();
+                    return value;
+                }
+                if (this->values_used == this->values.size())
+                    this->values.push_back(new std::string());
+                return this->values[this->values_used++];
+            }
+
+            void release_token(Token *token) {
+                if (token->value != nullptr)
+                    this->free_values.push_back(token->value);
+                this->free_tokens.push_back(token);
+            }
+
+            // Columns count code points. The count is carried forward along the current line so
+            // every byte is visited once per pass.
+            int column(int position) {
+                if (this->column_line_start != this->line_start || position < this->column_position) {
+                    this->column_line_start = this->line_start;
+                    this->column_position = this->line_start;
+                    this->column_code_points = 0;
+                }
+                this->column_code_points += count_code_points(this->source->body(), this->column_position, position);
+                this->column_position = position;
+                return 1 + this->column_code_points;
+            }
+
+            // Only strings, block strings and comments can hold non-ASCII bytes, so validating their
+            // ranges covers the whole document.
+            void check_utf8(int start, int end) {
+                const std::string &body = this->source->body();
+                int position = find_invalid_utf8(body, start, end);
+                while (position != -1) {
+                    this->syntax_error(position, "Invalid UTF-8 sequence.");
+                    position = find_invalid_utf8(body, position + 1, end);
+                }
+            }
+
+            Token *make_token(TokenKind kind, int start, int end, int line, int col, Token *prev, std::string *value = nullptr) {
+                if (kind == TokenKind::STRING || kind == TokenKind::BLOCK_STRING || kind == TokenKind::COMMENT)
+                    this->check_utf8(start, end);
+                if (this->materialize)
+                    return this->allocate_token(kind, start, end, line, col, prev, value);
+                this->scratch.kind = kind;
+                this->scratch.start = start;
+                this->scratch.end = end;
+                this->scratch.line = line;
+                this->scratch.column = col;
+                return &this->scratch;
+            }
+
+            std::string *make_value(int start, int end) {
+                if (!this->materialize)
+                    return nullptr;
+                std::string *value = this->allocate_value();
+                value->assign(this->source->body(), start, end - start);
+                return value;
+            }
+
+            std::string *make_scratch_value() {
+                if (!this->materialize)
+                    return nullptr;
+                std::string *value = this->allocate_value();
+                value->assign(this->scratch_value);
+                return value;
+            }
+
+            std::string *make_block_string_value(int start, int end) {
+                if (!this->materialize)
+                    return nullptr;
+                std::string *value = this->allocate_value();
+                decode_block_string(this->source->body(), start, end, *value);
+                return value;
+            }
+
+            // Location of a position on the current line, or earlier in the token being read, found
+            // from the line state instead of by scanning the body from its start.
+            SourceLocation location(int position) {
+                if (position >= this->line_start)
+                    return SourceLocation(this->line, this->column(position));
+                const std::string &body = this->source->body();
+                int line = this->line;
+                int line_start = this->line_start;
+                while (position < line_start) {
+                    line_start -= 1;
+                    if (body[line_start] == '\n' && line_start > 0 && body[line_start - 1] == '\r')
+                        line_start -= 1;
+                    line -= 1;
+                    while (line_start > 0 && body[line_start - 1] != '\n' && body[line_start - 1] != '\r')
+                        line_start -= 1;
+                }
+                return SourceLocation(line, count_code_points(body, line_start, position) + 1);
+            }
+
+            void syntax_error(int position, std::string description) {
+                GraphQLSyntaxError error(this->source, position, this->location(position), description);
+                if (!this->recover)
+                    throw error;
+                this->errors.push_back(error);
+            }
+
+            void restore_line_state(Token *token) {
+                const std::string &body = this->source->body();
+                this->column_line_start = -1;
+                if (token->kind == TokenKind::SOF) {
+                    this->line = 1;
+                    this->line_start = 0;
+                    return;
+                }
+                int position = token->start;
+                while (position > 0 && body[position - 1] != '\n' && body[position - 1] != '\r')
+                    position -= 1;
+                this->line = token->line;
+                this->line_start = position;
+                position = token->start;
+                while (position < token->end) {
+                    if (body[position] == '\r' && position + 1 < token->end && body[position + 1] == '\n')
+                        position += 1;
+                    if (body[position] == '\n' || body[position] == '\r') {
+                        this->line += 1;
+                        this->line_start = position + 1;
+                    }
+                    position += 1;
+                }
+            }
         public:
-            Lexer(Source *source) {
+            std::vector<GraphQLSyntaxError> errors;
+
+            // In recovery mode syntax errors are collected in `errors` instead of being thrown, and
+            // lexing resumes at the next point where a token can start.
+            Lexer(Source *source, bool recover = false) : sof_token(TokenKind::SOF, 0, 0, 0, 0), scratch(TokenKind::SOF, 0, 0, 0, 0), scratch_prev(TokenKind::SOF, 0, 0, 0, 0) {
+                this->materialize = true;
+                this->token_block = 0;
+                this->values_used = 0;
+                this->reset(source, recover);
+            }
+
+            Lexer(const Lexer &) = delete;
+            Lexer &operator=(const Lexer &) = delete;
+
+            // Tokens and their values belong to the lexer and are freed with it.
+            ~Lexer() {
+                for (auto value : this->values)
+                    delete value;
+            }
+
+            // Starts over on a new source. Every token and value handed out so far is reused, while
+            // the token blocks, value strings and scratch buffers keep their capacity.
+            void reset(Source *source, bool recover = false) {
                 this->source = source;
-                this->token = this->last_token = new Token(TokenKind::SOF, 0, 0, 0, 0);
+                this->recover = recover;
+                for (auto &block : this->token_blocks)
+                    block.clear();
+                this->token_block = 0;
+                this->free_tokens.clear();
+                this->values_used = 0;
+                this->free_values.clear();
+                this->sof_token.next = nullptr;
+                this->sof = this->token = this->last_token = &this->sof_token;
                 this->line = 1;
                 this->line_start = 0;
+                this->column_line_start = -1;
+                this->errors.clear();
+                this->error_tokens.clear();
             }
 
             Token *advance() {
@@ -377,8 +829,10 @@ namespace graphql {
                 Token *token = this->token;
                 if (token->kind != TokenKind::EOF) {
                     while (true) {
-                        if (token->next == nullptr)
+                        if (token->next == nullptr) {
                             token->next = this->read_token(token);
+                            this->error_tokens.resize(this->errors.size(), token->next);
+                        }
                         token = token->next;
                         if (token->kind != TokenKind::COMMENT)
                             break;
@@ -387,65 +841,298 @@ namespace graphql {
                 return token;
             }
 
-            Token *read_token(Token *prev) {
-                Source *source = this->source;
-                std::string body = source->body;
-                int body_length = body.length();
+            // Applies a text edit to the source and re-lexes only the affected region. Lexing restarts
+            // after the last token that ends before the edit and stops as soon as a freshly read token
+            // lines up with a previously read one; the remaining tokens are kept and their positions
+            // patched. In recovery mode errors from the re-lexed region are replaced, and later ones are
+            // patched like the tokens they belong to. Returns the first re-lexed token and rewinds
+            // the lexer to SOF.
+            Token *apply_edit(int offset, int removed_length, std::string inserted) {
+                const std::string &body = this->source->body();
+                if (offset < 0 || removed_length < 0 || offset + removed_length > (int) body.length())
+                    throw std::invalid_argument("edit range must lie within the source body.");
+                int delta = inserted.length() - removed_length;
+                int edit_end = offset + removed_length;
+                int resync_from = offset + inserted.length();
 
-                int pos = this->position_after_whitespace(body, prev->end);
-                int line = this->line;
-                int col = 1 + pos - this->line_start;
+                Token *safe = this->sof;
+                while (safe->next != nullptr && safe->next->kind != TokenKind::EOF && safe->next->end < offset)
+                    safe = safe->next;
 
-                if (pos >= body_length)
-                    return new Token(TokenKind::EOF, body_length, body_length, line, col, prev);
+                bool frontier_is_eof = false;
+                for (Token *token = safe; token != nullptr; token = token->next)
+                    frontier_is_eof = token->kind == TokenKind::EOF;
 
-                char &character = body[pos];
-                bool kind_fetched = true;
-                TokenKind kind;
+                // Errors are in token order. Those of the tokens up to safe stay, and the others are
+                // raised again or patched below.
+                size_t kept_errors = 0;
+                for (Token *token = this->sof; kept_errors < this->errors.size(); token = token->next) {
+                    while (kept_errors < this->errors.size() && this->error_tokens[kept_errors] == token)
+                        kept_errors += 1;
+                    if (token == safe)
+                        break;
+                }
+                std::vector<GraphQLSyntaxError> later_errors(this->errors.begin() + kept_errors, this->errors.end());
+                std::vector<Token *> later_error_tokens(this->error_tokens.begin() + kept_errors, this->error_tokens.end());
+                this->errors.erase(this->errors.begin() + kept_errors, this->errors.end());
+                this->error_tokens.resize(kept_errors);
+
+                Token *old = safe->next;
+                safe->next = nullptr;
+                std::string edited;
+                edited.reserve(body.length() + delta);
+                edited.append(body, 0, offset).append(inserted).append(body, edit_end, std::string::npos);
+                this->source->buffer = std::make_shared<const std::string>(std::move(edited));
+                for (auto &error : this->errors)
+                    error = GraphQLSyntaxError(this->source, (*error.positions)[0], (*error.locations)[0], error.description);
+                this->restore_line_state(safe);
+                this->token = this->last_token = this->sof;
+
+                Token *prev = safe;
+                while (true) {
+                    size_t token_errors = this->errors.size();
+                    Token *token = this->read_token(prev);
+                    this->error_tokens.resize(this->errors.size(), token);
+                    prev->next = token;
+                    while (old != nullptr && (old->start < edit_end || old->start + delta < token->start)) {
+                        Token *stale = old;
+                        old = old->next;
+                        this->release_token(stale);
+                    }
+                    if (token->start >= resync_from) {
+                        if (old != nullptr && old->kind == token->kind && old->start + delta == token->start && old->end + delta == token->end) {
+                            int old_line = old->line;
+                            int line_delta = token->line - old->line;
+                            int column_delta = token->column - old->column;
+                            Token *frontier = old;
+                            std::unordered_set<Token *> tail;
+                            for (Token *kept = old; kept != nullptr; kept = kept->next) {
+                                if (kept->line == old_line)
+                                    kept->column += column_delta;
+                                kept->line += line_delta;
+                                kept->start += delta;
+                                kept->end += delta;
+                                frontier = kept;
+                                if (kept != old && !later_errors.empty())
+                                    tail.insert(kept);
+                            }
+                            // Errors of the matched token were raised again by reading its
+                            // replacement; those of the tokens after it are patched like them.
+                            std::replace(this->error_tokens.begin() + token_errors, this->error_tokens.end(), token, old);
+                            for (size_t index = 0; index < later_errors.size(); index++) {
+                                if (tail.count(later_error_tokens[index]) == 0)
+                                    continue;
+                                GraphQLSyntaxError &error = later_errors[index];
+                                SourceLocation location = (*error.locations)[0];
+                                if (location.line == old_line)
+                                    location.column += column_delta;
+                                location.line += line_delta;
+                                this->errors.push_back(GraphQLSyntaxError(this->source, (*error.positions)[0] + delta, location, error.description));
+                                this->error_tokens.push_back(later_error_tokens[index]);
+                            }
+                            // Lazy reads continue after the last kept token
+                            this->restore_line_state(frontier);
+                            prev->next = old;
+                            old->prev = prev;
+                            this->release_token(token);
+                            break;
+                        }
+                        if (old == nullptr && !frontier_is_eof)
+                            break;
+                    }
+                    if (token->kind == TokenKind::EOF)
+                        break;
+                    prev = token;
+                }
+                return safe->next;
+            }
+
+            // Reads the token that follows `end` without allocating. The returned token carries no
+            // value and is overwritten by the next call.
+            Token *scan(int end) {
+                this->scratch_prev.end = end;
+                this->materialize = false;
                 try {
-                    kind = single_character_token_kinds.at(character);
-                } catch (std::out_of_range e) {
-                    kind_fetched = false;
+                    Token *token = this->read_token(&this->scratch_prev);
+                    this->error_tokens.resize(this->errors.size(), nullptr);
+                    this->materialize = true;
+                    return token;
+                } catch (...) {
+                    this->materialize = true;
+                    throw;
+                }
+            }
+
+            // Line state for scan() to go on from a position on `line`, which starts at `line_start`.
+            void set_line_state(int line, int line_start) {
+                this->line = line;
+                this->line_start = line_start;
+                this->column_line_start = -1;
+            }
+
+            SourceSlice slice(Token *token) {
+                return this->source->slice(token->start, token->end);
+            }
+
+            // Decodes the escape sequence at position, just past its backslash, into value and moves
+            // position past it. An invalid sequence adds nothing and skips only its first character,
+            // unless that ends the line. Returns whether the sequence was valid.
+            static bool read_escape(const std::string &body, int &position, std::string &value) {
+                int body_length = body.length();
+                char character = body[position];
+                bool valid = true;
+                if (character == '"' || character == '/' || character == '\\') {
+                    value += character;
+                } else if (character == 'b' || character == 'f' || character == 'n' || character == 'r' || character == 't') {
+                    value += get_escaped_character(character);
+                } else if (character == 'u' && position + 4 < body_length) {
+                    int code = uni_char_code(body.substr(position + 1, 4));
+                    int escape_length = 4;
+                    if (code >= 0xD800 && code <= 0xDBFF) {
+                        int low = -1;
+                        if (body.compare(position + 5, 2, "\\u") == 0 && position + 10 < body_length)
+                            low = uni_char_code(body.substr(position + 7, 4));
+                        if (low >= 0xDC00 && low <= 0xDFFF) {
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                            escape_length = 10;
+                        } else {
+                            code = -1;
+                        }
+                    } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                        code = -1;
+                    }
+                    if (code < 0) {
+                        valid = false;
+                    } else {
+                        append_utf8(value, code);
+                        position += escape_length;
+                    }
+                } else {
+                    valid = false;
+                }
+                if (position < body_length && character != '\n' && character != '\r')
+                    position += 1;
+                return valid;
+            }
+
+            // Value of the string token over [start, end), decoded from the body as read_string()
+            // decodes it while lexing.
+            static void decode_string(const std::string &body, int start, int end, std::string &value) {
+                value.clear();
+                int position = start + 1;
+                int chunk_start = position;
+                while (position < end && body[position] != '"') {
+                    if (body[position] == '\\') {
+                        value.append(body, chunk_start, position - chunk_start);
+                        position += 1;
+                        read_escape(body, position, value);
+                        chunk_start = position;
+                    } else {
+                        position += 1;
+                    }
                 }
-                if (kind_fetched)
-                    return new Token(kind, pos, pos + 1, line, col, prev);
-                if (character == '#')
-                    return this->read_comment(pos, line, col, prev);
-                else if (character == '.') {
-                    if (body[pos + 1] == '.' && body[pos + 2] == '.')
-                        return new Token(TokenKind::SPREAD, pos, pos + 3, line, col, prev);
+                value.append(body, chunk_start, position - chunk_start);
+            }
+
+            // Value of the block string token over [start, end): its raw text with \""" unescaped,
+            // then dedented.
+            static void decode_block_string(const std::string &body, int start, int end, std::string &value) {
+                value.clear();
+                int position = start + 3;
+                int chunk_start = position;
+                while (position < end && !(body[position] == '"' && body.compare(position + 1, 2, "\"\"") == 0)) {
+                    if (body[position] == '\\' && body.compare(position + 1, 3, "\"\"\"") == 0) {
+                        value.append(body, chunk_start, position - chunk_start).append("\"\"\"");
+                        position += 4;
+                        chunk_start = position;
+                    } else {
+                        position += 1;
+                    }
                 }
-                else if ((('A' <= character) && (character <= 'Z')) || (('a' <= character) && (character <= 'z')) || character == '_')
-                    return this->read_name(pos, line, col, prev);
-                else if ((('0' <= character) && (character <= '9')) || character == '-')
-                    return this->read_number(pos, character, line, col, prev);
-                else if (character == '"') {
-                    if (body[pos + 1] == '"' && body[pos + 2] == '"')
-                        return this->read_block_string(pos, line, col, prev);
-                    return this->read_string(pos, line, col, prev);
+                value.append(body, chunk_start, std::min(position, end) - chunk_start);
+                std::string *dedented = dedent_block_string_value(value);
+                value.assign(*dedented);
+                delete dedented;
+            }
+
+            // Decodes the value of the token at `start` into value, through the scratch buffers.
+            // Apart from dedenting block strings this only allocates when value has to grow.
+            void read_value(int start, std::string &value) {
+                Token *token = this->scan(start);
+                if (token->kind == TokenKind::BLOCK_STRING) {
+                    decode_block_string(this->source->body(), token->start, token->end, value);
+                } else if (token->kind == TokenKind::STRING) {
+                    value.assign(this->scratch_value);
+                } else {
+                    value.assign(this->source->body(), token->start, token->end - token->start);
                 }
+            }
+
+            Token *read_token(Token *prev) {
+                const std::string &body = this->source->body();
+                int body_length = body.length();
+
+                int pos = this->position_after_whitespace(body, prev->end);
+                while (true) {
+                    int line = this->line;
+                    int col = this->column(pos);
 
-                throw GraphQLSyntaxError(source, pos, unexpected_character_message(character));
+                    if (pos >= body_length)
+                        return this->make_token(TokenKind::EOF, body_length, body_length, line, col, prev);
+
+                    char character = body[pos];
+                    auto single_character = single_character_token_kinds.find(character);
+                    if (single_character != single_character_token_kinds.end())
+                        return this->make_token(single_character->second, pos, pos + 1, line, col, prev);
+                    if (character == '#')
+                        return this->read_comment(pos, line, col, prev);
+                    else if (character == '.') {
+                        if (body[pos + 1] == '.' && body[pos + 2] == '.')
+                            return this->make_token(TokenKind::SPREAD, pos, pos + 3, line, col, prev);
+                    }
+                    else if ((('A' <= character) && (character <= 'Z')) || (('a' <= character) && (character <= 'z')) || character == '_')
+                        return this->read_name(pos, line, col, prev);
+                    else if ((('0' <= character) && (character <= '9')) || character == '-')
+                        return this->read_number(pos, character, line, col, prev);
+                    else if (character == '"') {
+                        if (body[pos + 1] == '"' && body[pos + 2] == '"')
+                            return this->read_block_string(pos, line, col, prev);
+                        return this->read_string(pos, line, col, prev);
+                    }
+
+                    if (static_cast<unsigned char>(character) >= 0x80) {
+                        int length = utf8_sequence_length(body, pos);
+                        if (length == 0) {
+                            this->syntax_error(pos, "Invalid UTF-8 sequence.");
+                            length = 1;
+                        } else {
+                            this->syntax_error(pos, fmt::format("Cannot parse the unexpected character {}.", body.substr(pos, length)));
+                        }
+                        pos = this->position_after_whitespace(body, pos + length);
+                        continue;
+                    }
+                    this->syntax_error(pos, unexpected_character_message(character));
+                    pos = this->position_after_whitespace(body, pos + 1);
+                }
             }
 
             Token *read_comment(int start, int line, int col, Token *prev) {
-                std::string body = this->source->body;
+                const std::string &body = this->source->body();
                 int body_length = body.length();
                 int position = start;
                 while (true) {
                     position += 1;
                     if (position >= body_length)
                         break;
-                    char &character = body[position];
+                    unsigned char character = body[position];
                     if (character < ' ' && character != '\t')
                         break;
                 }
-                return new Token(TokenKind::COMMENT, start, position, line, col, prev, new std::string(&body[start + 1], &body[position]));
+                return this->make_token(TokenKind::COMMENT, start, position, line, col, prev, this->make_value(start + 1, position));
             }
 
             Token *read_number(int start, char &character, int line, int col, Token *prev) {
-                Source source = *this->source;
-                std::string body = source.body;
+                const std::string &body = this->source->body();
                 int position = start;
                 bool is_float = false;
                 char current_character = character;
@@ -457,17 +1144,24 @@ namespace graphql {
                     position += 1;
                     current_character = body[position];
                     if ('0' <= current_character && current_character <= '9') {
-                        throw GraphQLSyntaxError(this->source, position, fmt::format("Invalid number, unexpected digit after 0: {}", current_character));
+                        this->syntax_error(position, fmt::format("Invalid number, unexpected digit after 0: {}", current_character));
+                        return this->read_invalid_number(start, position, line, col, prev);
                     }
                 } else {
+                    int digits_start = position;
                     position = read_digits(position, current_character);
+                    if (position == digits_start)
+                        return this->read_invalid_number(start, position, line, col, prev);
                     current_character = body[position];
                 }
                 if (current_character == '.') {
                     is_float = true;
                     position += 1;
                     current_character = body[position];
+                    int digits_start = position;
                     position = read_digits(position, current_character);
+                    if (position == digits_start)
+                        return this->read_invalid_number(start, position, line, col, prev);
                     current_character = body[position];
                 }
                 if (current_character == 'e' || current_character == 'E') {
@@ -478,12 +1172,16 @@ namespace graphql {
                         position += 1;
                         current_character = body[position];
                     }
+                    int digits_start = position;
                     position = read_digits(position, current_character);
+                    if (position == digits_start)
+                        return this->read_invalid_number(start, position, line, col, prev);
                     current_character = body[position];
                 }
 
                 if (current_character == '.' || is_name_start(current_character)) {
-                    throw GraphQLSyntaxError(this->source, position, fmt::format("Invalid number, expected digit but got: {}", current_character));
+                    this->syntax_error(position, fmt::format("Invalid number, expected digit but got: {}", current_character));
+                    return this->read_invalid_number(start, position, line, col, prev);
                 }
 
                 TokenKind kind;
@@ -491,12 +1189,11 @@ namespace graphql {
                     kind = TokenKind::FLOAT;
                 else
                     kind = TokenKind::INT;
-                return new Token(kind, start, position, line, col, prev, new std::string(&body[start], &body[position]));
+                return this->make_token(kind, start, position, line, col, prev, this->make_value(start, position));
             }
 
             int read_digits(int start, char &character) {
-                Source source = *this->source;
-                std::string body = source.body;
+                const std::string &body = this->source->body();
                 int position = start;
                 char current_character = character;
                 while ('0' <= current_character && current_character <= '9') {
@@ -504,77 +1201,79 @@ namespace graphql {
                     current_character = body[position];
                 }
                 if (position == start) {
-                    throw GraphQLSyntaxError(this->source, position, fmt::format("Invalid number, expected digit but got: {}", current_character));
+                    this->syntax_error(position, fmt::format("Invalid number, expected digit but got: {}", current_character));
                 }
                 return position;
             }
 
+            Token *read_invalid_number(int start, int position, int line, int col, Token *prev) {
+                const std::string &body = this->source->body();
+                int body_length = body.length();
+                bool is_float = false;
+                while (position < body_length) {
+                    char character = body[position];
+                    if (!(character == '_' || character == '.' || ('0' <= character && character <= '9') || ('A' <= character && character <= 'Z') || ('a' <= character && character <= 'z')))
+                        break;
+                    position += 1;
+                }
+                for (int i = start; i < position; i++)
+                    if (body[i] == '.' || body[i] == 'e' || body[i] == 'E')
+                        is_float = true;
+                TokenKind kind;
+                if (is_float)
+                    kind = TokenKind::FLOAT;
+                else
+                    kind = TokenKind::INT;
+                return this->make_token(kind, start, position, line, col, prev, this->make_value(start, position));
+            }
+
             Token *read_string(int start, int line, int col, Token *prev) {
-                Source source = *this->source;
-                std::string body = source.body;
+                const std::string &body = this->source->body();
                 int body_length = body.length();
                 int position = start + 1;
                 int chunk_start = position;
-                std::vector<std::string> value;
+                std::string &value = this->scratch_value;
+                value.clear();
 
                 while (position < body_length) {
-                    char &character = body[position];
+                    char character = body[position];
                     if (character == '\n' || character == '\r')
                         break;
                     if (character == '"') {
-                        value.push_back(std::string(&body[chunk_start], &body[position]));
-                        const char* const delimiter = "";
-                        std::ostringstream imploded_value;
-                        std::copy(value.begin(), value.end(), std::ostream_iterator<std::string>(imploded_value, delimiter));
-                        return new Token(TokenKind::STRING, start, position + 1, line, col, prev, new std::string(imploded_value.str()));
+                        value.append(body, chunk_start, position - chunk_start);
+                        return this->make_token(TokenKind::STRING, start, position + 1, line, col, prev, this->make_scratch_value());
                     }
-                    if (character < ' ' && character != '\t') {
-                        throw GraphQLSyntaxError(this->source, position, fmt::format("Invalid character within String: {}", character));
+                    if (static_cast<unsigned char>(character) < ' ' && character != '\t') {
+                        this->syntax_error(position, fmt::format("Invalid character within String: {}", character));
                     }
                     position += 1;
                     if (character == '\\') {
-                        value.push_back(std::string(&body[chunk_start], &body[position - 1]));
-                        character = body[position];
-                        if (character == '"' || character == '/' || character == '\\') {
-                            value.push_back(std::string(&body[position], &body[position + 1]));
-                        } else if (character == 'b' || character == 'f' || character == 'n' || character == 'r' || character == 't') {
-                            value.push_back(std::string(1, get_escaped_character(character)));
-                        } else if (character == 'u' && position + 4 < body_length) {
-                            int code = uni_char_code(std::string(&body[position + 1], &body[position + 5]));
-                            if (code < 0) {
-                                std::string escape = std::string(&body[position], &body[position + 5]);
-                                throw GraphQLSyntaxError(this->source, position, fmt::format("Invalid character escape sequence: {}", escape));
-                            }
-                            value.push_back(std::string(1, static_cast<char>(code)));
-                            position += 4;
-                        } else {
-                            std::string escape = std::string(1, character);
-                            throw GraphQLSyntaxError(this->source, position, fmt::format("Invalid character escape sequence: {}", escape));
+                        value.append(body, chunk_start, position - 1 - chunk_start);
+                        int escape = position;
+                        if (!read_escape(body, position, value)) {
+                            std::string sequence = body[escape] == 'u' && escape + 4 < body_length ? body.substr(escape, 5) : std::string(1, body[escape]);
+                            this->syntax_error(escape, fmt::format("Invalid character escape sequence: {}", sequence));
                         }
-                        position += 1;
                         chunk_start = position;
                     }
                 }
 
-                throw GraphQLSyntaxError(this->source, position, "Unterminated string.");
+                this->syntax_error(position, "Unterminated string.");
+                value.append(body, chunk_start, position - chunk_start);
+                return this->make_token(TokenKind::STRING, start, position, line, col, prev, this->make_scratch_value());
             }
 
             Token *read_block_string(int start, int line, int col, Token *prev) {
-                Source source = *this->source;
-                std::string body = source.body;
+                const std::string &body = this->source->body();
                 int body_length = body.length();
                 int position = start + 3;
-                int chunk_start = position;
-                std::string raw_value = "";
 
                 while (position < body_length) {
-                    char &character = body[position];
-                    if (character == '"' && std::string(&body[position + 1], &body[position + 3]) == "\"\"") {
-                        raw_value.append(std::string(&body[chunk_start], &body[position]));
-                        return new Token(TokenKind::BLOCK_STRING, start, position + 3, line, col, prev, dedent_block_string_value(raw_value));
-                    }
-                    if (character < ' ' && character != '\t' && character != '\n' && character != '\r') {
-                        throw GraphQLSyntaxError(this->source, position, fmt::format("Invalid character within String: {}", character));
+                    char character = body[position];
+                    if (character == '"' && body.compare(position + 1, 2, "\"\"") == 0)
+                        return this->make_token(TokenKind::BLOCK_STRING, start, position + 3, line, col, prev, this->make_block_string_value(start, position + 3));
+                    if (static_cast<unsigned char>(character) < ' ' && character != '\t' && character != '\n' && character != '\r') {
+                        this->syntax_error(position, fmt::format("Invalid character within String: {}", character));
                     }
                     if (character == '\n') {
                         position += 1;
@@ -587,41 +1286,41 @@ namespace graphql {
                             position += 1;
                         this->line += 1;
                         this->line_start = position;
-                    } else if (character == '\\' && std::string(&body[position + 1], &body[position + 4]) == "\"\"\"") {
-                        raw_value.append(std::string(&body[chunk_start], &body[position]));
+                    } else if (character == '\\' && body.compare(position + 1, 3, "\"\"\"") == 0) {
                         position += 4;
-                        chunk_start = position;
                     } else {
                         position += 1;
                     }
                 }
 
-                throw GraphQLSyntaxError(this->source, position, "Unterminated string.");
+                this->syntax_error(position, "Unterminated string.");
+                return this->make_token(TokenKind::BLOCK_STRING, start, position, line, col, prev, this->make_block_string_value(start, position));
             }
 
 
             Token *read_name(int start, int line, int col, Token *prev) {
-                std::string body = this->source->body;
+                const std::string &body = this->source->body();
                 int body_length = body.length();
                 int position = start + 1;
                 while (position < body_length) {
-                    char &character = body[position];
+                    char character = body[position];
                     if (!(character == '_' || ('0' <= character && character <= '9') || ('A' <= character && character <= 'Z') || ('a' <= character && character <= 'z')))
                         break;
                     position += 1;
                 }
-                return new Token(TokenKind::NAME, start, position, line, col, prev, new std::string(&body[start], &body[position]));
+                return this->make_token(TokenKind::NAME, start, position, line, col, prev, this->make_value(start, position));
             }
 
 
-            int position_after_whitespace(std::string body, int start_position) {
+            int position_after_whitespace(const std::string &body, int start_position) {
                 int body_length = body.length();
                 int position = start_position;
                 while (position < body_length) {
-                    char &character = body[position];
-                    std::string character_set = " \t,\ufeff"; // TODO: BOM checked against correctly?
-                    if (character_set.find(character) != std::string::npos) {
+                    char character = body[position];
+                    if (character == ' ' || character == '\t' || character == ',') {
                         position += 1;
+                    } else if (character == '\xEF' && body.compare(position, 3, "\xEF\xBB\xBF") == 0) {
+                        position += 3;
                     } else if (character == '\n') {
                         position += 1;
                         this->line += 1;
@@ -640,5 +1339,3546 @@ namespace graphql {
                 return position;
             }
     };
-}
 
+    bool is_literal_token(TokenKind kind) {
+        return kind == TokenKind::INT || kind == TokenKind::FLOAT || kind == TokenKind::STRING || kind == TokenKind::BLOCK_STRING;
+    }
+
+    const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+    const uint64_t FNV_PRIME = 1099511628211ull;
+
+    // Token stream packed as parallel arrays of kinds and byte offsets, always ending with EOF.
+    // Comments are dropped, and line, column and value are derived from the source on demand.
+    // The buffer keeps its own reference to the source text and is safe to share across threads
+    // once constructed.
+    class TokenBuffer {
+        private:
+            mutable std::vector<uint32_t> line_starts;
+            mutable std::mutex lines_mutex;
+            mutable bool lines_indexed;
+            bool recover;
+            // Index of the token each error was raised while reading, comments counting toward the
+            // token after them, so edits can tell which errors they redo.
+            std::vector<uint32_t> error_tokens;
+
+            // Token kind as it enters the signature. Both string forms hash alike.
+            static uint8_t signature_kind(TokenKind kind) {
+                return kind == TokenKind::BLOCK_STRING ? TokenKind::STRING : kind;
+            }
+
+            // Where a token stands in a directive: 1 after '@', 2 after its name, 3 inside its
+            // arguments. Plans do not rebind directive arguments, so their literals are hashed
+            // with their text.
+            static int directive_state(int state, TokenKind kind) {
+                if (kind == TokenKind::AT)
+                    return 1;
+                if (state == 1 && kind == TokenKind::NAME)
+                    return 2;
+                if ((state == 2 && kind == TokenKind::PAREN_L) || (state == 3 && kind != TokenKind::PAREN_R))
+                    return 3;
+                return 0;
+            }
+
+            static bool hashes_text(int state, TokenKind kind) {
+                return kind == TokenKind::NAME || (state == 3 && is_literal_token(kind));
+            }
+
+            // Folds one token into the signature. Names and directive arguments are hashed with their
+            // text; other literals only by kind. Kinds are below every name character, so they also
+            // separate adjacent names.
+            static uint64_t sign(uint64_t signature, int &directive, TokenKind kind, const char *body, int start, int end) {
+                directive = directive_state(directive, kind);
+                signature = (signature ^ signature_kind(kind)) * FNV_PRIME;
+                if (hashes_text(directive, kind))
+                    for (int position = start; position < end; position++)
+                        signature = (signature ^ static_cast<uint8_t>(body[position])) * FNV_PRIME;
+                return signature;
+            }
+
+            void tokenize() {
+                Lexer &lexer = this->lexer;
+                lexer.reset(&this->source, this->recover);
+                const char *body = this->source.body().data();
+                uint64_t signature = FNV_OFFSET_BASIS;
+                int directive = 0;
+                int end = 0;
+                while (true) {
+                    Token *token = lexer.scan(end);
+                    end = token->end;
+                    if (token->kind == TokenKind::COMMENT)
+                        continue;
+                    this->kinds.push_back(token->kind);
+                    this->starts.push_back(token->start);
+                    this->ends.push_back(token->end);
+                    this->error_tokens.resize(lexer.errors.size(), this->kinds.size() - 1);
+                    signature = sign(signature, directive, token->kind, body, token->start, token->end);
+                    if (token->kind == TokenKind::EOF)
+                        break;
+                }
+                this->signature = signature;
+                this->errors = lexer.errors;
+            }
+
+            const std::vector<uint32_t> &lines() const {
+                std::lock_guard<std::mutex> lock(this->lines_mutex);
+                if (!this->lines_indexed) {
+                    this->line_starts.push_back(0);
+                    add_line_starts(this->source.body(), 0, this->source.body().length(), this->line_starts);
+                    this->lines_indexed = true;
+                }
+                return this->line_starts;
+            }
+
+            SourceLocation position_location(int position) const {
+                const std::vector<uint32_t> &line_starts = this->lines();
+                auto next_line = std::upper_bound(line_starts.begin(), line_starts.end(), position);
+                int line = next_line - line_starts.begin();
+                return SourceLocation(line, 1 + count_code_points(this->source.body(), *(next_line - 1), position));
+            }
+        public:
+            Source source;
+            std::vector<uint8_t> kinds;
+            std::vector<uint32_t> starts;
+            std::vector<uint32_t> ends;
+            std::vector<GraphQLSyntaxError> errors;
+            // FNV-1a hash of the document's shape, computed while lexing: token kinds and names,
+            // with literals as placeholders and ignored tokens left out. Literals in directive
+            // arguments keep their text. Documents that differ only in other literal values or
+            // formatting have the same signature.
+            uint64_t signature;
+        private:
+            // Kept for its scratch buffers, so reset() does not allocate.
+            Lexer lexer;
+        public:
+            TokenBuffer(Source *source, bool recover = false) : source(*source), lexer(&this->source) {
+                this->lines_indexed = false;
+                this->recover = recover;
+                // Queries average a few bytes per token, so this is enough to lex most of them
+                // without growing the arrays; the slack is trimmed below.
+                size_t estimate = this->source.body().length() / 4 + 1;
+                this->kinds.reserve(estimate);
+                this->starts.reserve(estimate);
+                this->ends.reserve(estimate);
+                this->tokenize();
+                this->kinds.shrink_to_fit();
+                this->starts.shrink_to_fit();
+                this->ends.shrink_to_fit();
+            }
+
+            // Re-lexes a new source into the same arrays, keeping their capacity. Not safe while
+            // other threads read the buffer.
+            void reset(Source *source) {
+                this->source = *source;
+                this->kinds.clear();
+                this->starts.clear();
+                this->ends.clear();
+                this->errors.clear();
+                this->error_tokens.clear();
+                this->line_starts.clear();
+                this->lines_indexed = false;
+                this->tokenize();
+            }
+
+            // Applies a text edit to the source and re-lexes only the tokens it touches, the way
+            // Lexer::apply_edit does. The tokens after the point where lexing lines up again, their
+            // errors and the line index are shifted instead of recomputed, and the signature is
+            // rehashed from the arrays. Returns the range of re-lexed token indices: tokens before
+            // it are unchanged and those after it only moved, so an empty range means no token
+            // changed. Not safe while other threads read the buffer.
+            std::pair<size_t, size_t> apply_edit(int offset, int removed_length, std::string inserted) {
+                const std::string &body = this->source.body();
+                if (offset < 0 || removed_length < 0 || offset + removed_length > (int) body.length())
+                    throw std::invalid_argument("edit range must lie within the source body.");
+                int delta = inserted.length() - removed_length;
+                int edit_end = offset + removed_length;
+                int resync_from = offset + inserted.length();
+                size_t first = std::lower_bound(this->ends.begin(), this->ends.end(), (uint32_t) offset) - this->ends.begin();
+                int from = first > 0 ? this->ends[first - 1] : 0;
+
+                const std::vector<uint32_t> &line_starts = this->lines();
+                int line = std::upper_bound(line_starts.begin(), line_starts.end(), (uint32_t) from) - line_starts.begin();
+                int line_start = line_starts[line - 1];
+                std::shared_ptr<const std::string> buffer = this->source.buffer;
+                std::string edited;
+                edited.reserve(body.length() + delta);
+                edited.append(body, 0, offset).append(inserted).append(body, edit_end, std::string::npos);
+                this->source.buffer = std::make_shared<const std::string>(std::move(edited));
+
+                Lexer &lexer = this->lexer;
+                lexer.reset(&this->source, this->recover);
+                lexer.set_line_state(line, line_start);
+                std::vector<uint8_t> kinds;
+                std::vector<uint32_t> starts;
+                std::vector<uint32_t> ends;
+                std::vector<uint32_t> error_tokens;
+                size_t old = first;
+                int end = from;
+                try {
+                    while (true) {
+                        Token *token = lexer.scan(end);
+                        end = token->end;
+                        if (token->kind == TokenKind::COMMENT)
+                            continue;
+                        while (old < this->size() && ((int) this->starts[old] < edit_end || (int) this->starts[old] + delta < token->start))
+                            old += 1;
+                        // An empty range has to mean that no token was dropped either.
+                        if (token->start >= resync_from && old < this->size() && this->kind(old) == token->kind
+                                && (int) this->starts[old] + delta == token->start && (int) this->ends[old] + delta == token->end
+                                && (!kinds.empty() || old == first))
+                            break;
+                        kinds.push_back(token->kind);
+                        starts.push_back(token->start);
+                        ends.push_back(token->end);
+                        error_tokens.resize(lexer.errors.size(), first + kinds.size() - 1);
+                        if (token->kind == TokenKind::EOF) {
+                            old = this->size();
+                            break;
+                        }
+                    }
+                } catch (...) {
+                    this->source.buffer = buffer;
+                    throw;
+                }
+
+                // Line starts before the edit stay and those after it move; only the edited stretch
+                // is scanned again.
+                size_t kept_lines = std::lower_bound(this->line_starts.begin(), this->line_starts.end(), (uint32_t) std::max(offset, 1)) - this->line_starts.begin();
+                size_t moved_lines = std::lower_bound(this->line_starts.begin(), this->line_starts.end(), (uint32_t) edit_end + 1) - this->line_starts.begin();
+                std::vector<uint32_t> edited_lines;
+                add_line_starts(this->source.body(), std::max(offset - 1, 0), resync_from, edited_lines);
+                for (size_t index = moved_lines; index < this->line_starts.size(); index++)
+                    this->line_starts[index] += delta;
+                this->line_starts.erase(this->line_starts.begin() + kept_lines, this->line_starts.begin() + moved_lines);
+                this->line_starts.insert(this->line_starts.begin() + kept_lines, edited_lines.begin(), edited_lines.end());
+
+                size_t last = first + kinds.size();
+                // Errors raised while reading the token lexing lined up on replace its old ones.
+                error_tokens.resize(lexer.errors.size(), last);
+
+                // Kept errors are raised again so that they refer to the edited source.
+                size_t kept_errors = std::lower_bound(this->error_tokens.begin(), this->error_tokens.end(), first) - this->error_tokens.begin();
+                std::vector<GraphQLSyntaxError> errors;
+                for (size_t index = 0; index < kept_errors; index++) {
+                    GraphQLSyntaxError &error = this->errors[index];
+                    errors.push_back(GraphQLSyntaxError(&this->source, (*error.positions)[0], (*error.locations)[0], error.description));
+                }
+                errors.insert(errors.end(), lexer.errors.begin(), lexer.errors.end());
+                error_tokens.insert(error_tokens.begin(), this->error_tokens.begin(), this->error_tokens.begin() + kept_errors);
+                for (size_t index = std::upper_bound(this->error_tokens.begin(), this->error_tokens.end(), old) - this->error_tokens.begin(); index < this->errors.size(); index++) {
+                    int position = (*this->errors[index].positions)[0] + delta;
+                    errors.push_back(GraphQLSyntaxError(&this->source, position, this->position_location(position), this->errors[index].description));
+                    error_tokens.push_back(this->error_tokens[index] - old + last);
+                }
+                this->errors = std::move(errors);
+                this->error_tokens = std::move(error_tokens);
+
+                for (size_t index = old; index < this->size(); index++) {
+                    this->starts[index] += delta;
+                    this->ends[index] += delta;
+                }
+                this->kinds.erase(this->kinds.begin() + first, this->kinds.begin() + old);
+                this->kinds.insert(this->kinds.begin() + first, kinds.begin(), kinds.end());
+                this->starts.erase(this->starts.begin() + first, this->starts.begin() + old);
+                this->starts.insert(this->starts.begin() + first, starts.begin(), starts.end());
+                this->ends.erase(this->ends.begin() + first, this->ends.begin() + old);
+                this->ends.insert(this->ends.begin() + first, ends.begin(), ends.end());
+
+                const char *edited_body = this->source.body().data();
+                uint64_t signature = FNV_OFFSET_BASIS;
+                int directive = 0;
+                for (size_t index = 0; index < this->size(); index++)
+                    signature = sign(signature, directive, this->kind(index), edited_body, this->starts[index], this->ends[index]);
+                this->signature = signature;
+                return std::make_pair(first, last);
+            }
+
+            // Index of the first token that starts at or after the position.
+            size_t token_at(int position) const {
+                return std::lower_bound(this->starts.begin(), this->starts.end(), (uint32_t) position) - this->starts.begin();
+            }
+
+            size_t size() const {
+                return this->kinds.size();
+            }
+
+            // Whether both documents have the same shape, as the signature hashes it.
+            bool same_signature(const TokenBuffer &other) const {
+                if (this->signature != other.signature || this->size() != other.size())
+                    return false;
+                int directive = 0;
+                for (size_t index = 0; index < this->size(); index++) {
+                    if (signature_kind(this->kind(index)) != signature_kind(other.kind(index)))
+                        return false;
+                    directive = directive_state(directive, this->kind(index));
+                    if (hashes_text(directive, this->kind(index)) && this->text(index) != other.text(index))
+                        return false;
+                }
+                return true;
+            }
+
+            TokenKind kind(size_t index) const {
+                return static_cast<TokenKind>(this->kinds[index]);
+            }
+
+            int start(size_t index) const {
+                return this->starts[index];
+            }
+
+            int end(size_t index) const {
+                return this->ends[index];
+            }
+
+            std::string_view text(size_t index) const {
+                return std::string_view(this->source.body()).substr(this->starts[index], this->ends[index] - this->starts[index]);
+            }
+
+            SourceSlice slice(size_t index) const {
+                return this->source.slice(this->starts[index], this->ends[index]);
+            }
+
+            std::string value(size_t index) const {
+                TokenKind kind = this->kind(index);
+                std::string value;
+                if (kind == TokenKind::STRING)
+                    Lexer::decode_string(this->source.body(), this->starts[index], this->ends[index], value);
+                else if (kind == TokenKind::BLOCK_STRING)
+                    Lexer::decode_block_string(this->source.body(), this->starts[index], this->ends[index], value);
+                else if (kind == TokenKind::NAME || kind == TokenKind::INT || kind == TokenKind::FLOAT)
+                    value.assign(this->text(index));
+                return value;
+            }
+
+            SourceLocation location(size_t index) const {
+                return this->position_location(this->starts[index]);
+            }
+    };
+
+    // Forward cursor over a TokenBuffer for parsers. Advancing past EOF stays on EOF.
+    class TokenCursor {
+        private:
+            TokenBuffer *tokens;
+            size_t index;
+        public:
+            TokenCursor(TokenBuffer *tokens, size_t index = 0) {
+                this->tokens = tokens;
+                this->index = index;
+            }
+
+            size_t position() const {
+                return this->index;
+            }
+
+            TokenKind kind() const {
+                return this->tokens->kind(this->index);
+            }
+
+            TokenKind peek(size_t offset = 1) const {
+                return this->tokens->kind(std::min(this->index + offset, this->tokens->size() - 1));
+            }
+
+            int start() const {
+                return this->tokens->start(this->index);
+            }
+
+            int end() const {
+                return this->tokens->end(this->index);
+            }
+
+            std::string_view text() const {
+                return this->tokens->text(this->index);
+            }
+
+            std::string value() const {
+                return this->tokens->value(this->index);
+            }
+
+            SourceLocation location() const {
+                return this->tokens->location(this->index);
+            }
+
+            bool advance() {
+                if (this->kind() == TokenKind::EOF)
+                    return false;
+                this->index += 1;
+                return true;
+            }
+    };
+
+    // Executable document AST, following graphql-js. Every node records its byte range in the
+    // source and is owned by the DocumentNode it was parsed into. clear() resets a node for reuse
+    // by a parser while keeping the capacity of its strings and vectors.
+    class Node {
+        public:
+            int start = 0;
+            int end = 0;
+
+            virtual ~Node() { }
+
+            virtual void clear() {
+                this->start = 0;
+                this->end = 0;
+            }
+    };
+
+    enum ValueKind {
+        VARIABLE,
+        INT_VALUE,
+        FLOAT_VALUE,
+        STRING_VALUE,
+        BOOLEAN_VALUE,
+        NULL_VALUE,
+        ENUM_VALUE,
+        LIST_VALUE,
+        OBJECT_VALUE
+    };
+
+    class ObjectFieldNode;
+
+    class ValueNode : public Node {
+        public:
+            ValueKind kind = NULL_VALUE;
+            // Variable name, raw number text, decoded string, enum name or "true"/"false".
+            std::string value;
+            bool block = false;
+            std::vector<ValueNode *> values;
+            std::vector<ObjectFieldNode *> fields;
+
+            void clear() override {
+                Node::clear();
+                this->kind = NULL_VALUE;
+                this->value.clear();
+                this->block = false;
+                this->values.clear();
+                this->fields.clear();
+            }
+    };
+
+    class ObjectFieldNode : public Node {
+        public:
+            std::string name;
+            ValueNode *value = nullptr;
+
+            void clear() override {
+                Node::clear();
+                this->name.clear();
+                this->value = nullptr;
+            }
+    };
+
+    class ArgumentNode : public Node {
+        public:
+            std::string name;
+            ValueNode *value = nullptr;
+
+            void clear() override {
+                Node::clear();
+                this->name.clear();
+                this->value = nullptr;
+            }
+    };
+
+    class DirectiveNode : public Node {
+        public:
+            std::string name;
+            std::vector<ArgumentNode *> arguments;
+
+            void clear() override {
+                Node::clear();
+                this->name.clear();
+                this->arguments.clear();
+            }
+    };
+
+    enum TypeKind {
+        NAMED_TYPE,
+        LIST_TYPE,
+        NON_NULL_TYPE
+    };
+
+    class TypeNode : public Node {
+        public:
+            TypeKind kind = NAMED_TYPE;
+            std::string name;
+            TypeNode *type = nullptr;
+
+            void clear() override {
+                Node::clear();
+                this->kind = NAMED_TYPE;
+                this->name.clear();
+                this->type = nullptr;
+            }
+    };
+
+    std::string print_type(TypeNode *type) {
+        if (type->kind == LIST_TYPE)
+            return fmt::format("[{}]", print_type(type->type));
+        if (type->kind == NON_NULL_TYPE)
+            return fmt::format("{}!", print_type(type->type));
+        return type->name;
+    }
+
+    enum SelectionKind {
+        FIELD,
+        FRAGMENT_SPREAD,
+        INLINE_FRAGMENT
+    };
+
+    class SelectionNode : public Node {
+        public:
+            SelectionKind kind;
+            std::vector<DirectiveNode *> directives;
+
+            void clear() override {
+                Node::clear();
+                this->directives.clear();
+            }
+    };
+
+    class SelectionSetNode : public Node {
+        public:
+            std::vector<SelectionNode *> selections;
+
+            void clear() override {
+                Node::clear();
+                this->selections.clear();
+            }
+    };
+
+    class FieldNode : public SelectionNode {
+        public:
+            std::string alias;
+            std::string name;
+            std::vector<ArgumentNode *> arguments;
+            SelectionSetNode *selection_set = nullptr;
+
+            FieldNode() {
+                this->kind = FIELD;
+            }
+
+            const std::string &response_name() const {
+                return this->alias.empty() ? this->name : this->alias;
+            }
+
+            void clear() override {
+                SelectionNode::clear();
+                this->alias.clear();
+                this->name.clear();
+                this->arguments.clear();
+                this->selection_set = nullptr;
+            }
+    };
+
+    class FragmentSpreadNode : public SelectionNode {
+        public:
+            std::string name;
+
+            FragmentSpreadNode() {
+                this->kind = FRAGMENT_SPREAD;
+            }
+
+            void clear() override {
+                SelectionNode::clear();
+                this->name.clear();
+            }
+    };
+
+    class InlineFragmentNode : public SelectionNode {
+        public:
+            // Empty when the fragment has no type condition.
+            std::string type_condition;
+            SelectionSetNode *selection_set = nullptr;
+
+            InlineFragmentNode() {
+                this->kind = INLINE_FRAGMENT;
+            }
+
+            void clear() override {
+                SelectionNode::clear();
+                this->type_condition.clear();
+                this->selection_set = nullptr;
+            }
+    };
+
+    enum DefinitionKind {
+        OPERATION_DEFINITION,
+        FRAGMENT_DEFINITION,
+        SCHEMA_DEFINITION,
+        SCALAR_TYPE_DEFINITION,
+        OBJECT_TYPE_DEFINITION,
+        INTERFACE_TYPE_DEFINITION,
+        UNION_TYPE_DEFINITION,
+        ENUM_TYPE_DEFINITION,
+        INPUT_OBJECT_TYPE_DEFINITION,
+        DIRECTIVE_DEFINITION
+    };
+
+    class DefinitionNode : public Node {
+        public:
+            DefinitionKind kind;
+    };
+
+    enum OperationType {
+        QUERY,
+        MUTATION,
+        SUBSCRIPTION
+    };
+
+    class VariableDefinitionNode : public Node {
+        public:
+            std::string name;
+            TypeNode *type = nullptr;
+            ValueNode *default_value = nullptr;
+            std::vector<DirectiveNode *> directives;
+
+            void clear() override {
+                Node::clear();
+                this->name.clear();
+                this->type = nullptr;
+                this->default_value = nullptr;
+                this->directives.clear();
+            }
+    };
+
+    class OperationDefinitionNode : public DefinitionNode {
+        public:
+            OperationType operation = QUERY;
+            std::string name;
+            std::vector<VariableDefinitionNode *> variable_definitions;
+            std::vector<DirectiveNode *> directives;
+            SelectionSetNode *selection_set = nullptr;
+
+            OperationDefinitionNode() {
+                this->kind = OPERATION_DEFINITION;
+            }
+
+            void clear() override {
+                DefinitionNode::clear();
+                this->operation = QUERY;
+                this->name.clear();
+                this->variable_definitions.clear();
+                this->directives.clear();
+                this->selection_set = nullptr;
+            }
+    };
+
+    class FragmentDefinitionNode : public DefinitionNode {
+        public:
+            std::string name;
+            std::string type_condition;
+            std::vector<DirectiveNode *> directives;
+            SelectionSetNode *selection_set = nullptr;
+
+            FragmentDefinitionNode() {
+                this->kind = FRAGMENT_DEFINITION;
+            }
+
+            void clear() override {
+                DefinitionNode::clear();
+                this->name.clear();
+                this->type_condition.clear();
+                this->directives.clear();
+                this->selection_set = nullptr;
+            }
+    };
+
+    std::vector<std::string> directive_locations {
+        "QUERY", "MUTATION", "SUBSCRIPTION", "FIELD", "FRAGMENT_DEFINITION", "FRAGMENT_SPREAD", "INLINE_FRAGMENT",
+        "VARIABLE_DEFINITION", "SCHEMA", "SCALAR", "OBJECT", "FIELD_DEFINITION", "ARGUMENT_DEFINITION", "INTERFACE",
+        "UNION", "ENUM", "ENUM_VALUE", "INPUT_OBJECT", "INPUT_FIELD_DEFINITION"
+    };
+
+    // Arguments and input object fields.
+    class InputValueDefinitionNode : public Node {
+        public:
+            std::string description;
+            std::string name;
+            TypeNode *type = nullptr;
+            ValueNode *default_value = nullptr;
+            std::vector<DirectiveNode *> directives;
+
+            void clear() override {
+                Node::clear();
+                this->description.clear();
+                this->name.clear();
+                this->type = nullptr;
+                this->default_value = nullptr;
+                this->directives.clear();
+            }
+    };
+
+    class FieldDefinitionNode : public Node {
+        public:
+            std::string description;
+            std::string name;
+            std::vector<InputValueDefinitionNode *> arguments;
+            TypeNode *type = nullptr;
+            std::vector<DirectiveNode *> directives;
+
+            void clear() override {
+                Node::clear();
+                this->description.clear();
+                this->name.clear();
+                this->arguments.clear();
+                this->type = nullptr;
+                this->directives.clear();
+            }
+    };
+
+    class EnumValueDefinitionNode : public Node {
+        public:
+            std::string description;
+            std::string name;
+            std::vector<DirectiveNode *> directives;
+
+            void clear() override {
+                Node::clear();
+                this->description.clear();
+                this->name.clear();
+                this->directives.clear();
+            }
+    };
+
+    class SchemaDefinitionNode : public DefinitionNode {
+        public:
+            std::string description;
+            bool extension = false;
+            std::vector<DirectiveNode *> directives;
+            std::vector<std::pair<OperationType, std::string>> operation_types;
+
+            SchemaDefinitionNode() {
+                this->kind = SCHEMA_DEFINITION;
+            }
+
+            void clear() override {
+                DefinitionNode::clear();
+                this->description.clear();
+                this->extension = false;
+                this->directives.clear();
+                this->operation_types.clear();
+            }
+    };
+
+    // Definitions and extensions of every named type; kind tells which of the lists apply.
+    class TypeDefinitionNode : public DefinitionNode {
+        public:
+            std::string description;
+            std::string name;
+            bool extension = false;
+            // Object and interface types
+            std::vector<std::string> interfaces;
+            std::vector<FieldDefinitionNode *> fields;
+            // Union types
+            std::vector<std::string> types;
+            // Enum types
+            std::vector<EnumValueDefinitionNode *> values;
+            // Input object types
+            std::vector<InputValueDefinitionNode *> input_fields;
+            std::vector<DirectiveNode *> directives;
+
+            TypeDefinitionNode() {
+                this->kind = OBJECT_TYPE_DEFINITION;
+            }
+
+            void clear() override {
+                DefinitionNode::clear();
+                this->description.clear();
+                this->name.clear();
+                this->extension = false;
+                this->interfaces.clear();
+                this->fields.clear();
+                this->types.clear();
+                this->values.clear();
+                this->input_fields.clear();
+                this->directives.clear();
+            }
+    };
+
+    class DirectiveDefinitionNode : public DefinitionNode {
+        public:
+            std::string description;
+            std::string name;
+            std::vector<InputValueDefinitionNode *> arguments;
+            bool repeatable = false;
+            std::vector<std::string> locations;
+
+            DirectiveDefinitionNode() {
+                this->kind = DIRECTIVE_DEFINITION;
+            }
+
+            void clear() override {
+                DefinitionNode::clear();
+                this->description.clear();
+                this->name.clear();
+                this->arguments.clear();
+                this->repeatable = false;
+                this->locations.clear();
+            }
+    };
+
+    class ArgumentPlan;
+    class FieldPlanner;
+
+    // Concrete object types of each abstract type, as provided by a schema.
+    typedef std::map<std::string, std::unordered_set<std::string>> PossibleTypes;
+
+    class DocumentNode : public Node {
+        private:
+            std::mutex plans_mutex;
+            std::map<std::string, ArgumentPlan *> argument_plans;
+            std::map<const PossibleTypes *, FieldPlanner *> field_planners;
+        public:
+            std::shared_ptr<TokenBuffer> tokens;
+            std::vector<DefinitionNode *> definitions;
+            std::vector<FragmentDefinitionNode *> fragments;
+            // Every node parsed into this document, freed with it.
+            std::vector<Node *> nodes;
+
+            DocumentNode(std::shared_ptr<TokenBuffer> tokens) {
+                this->tokens = std::move(tokens);
+            }
+
+            DocumentNode(const DocumentNode &) = delete;
+            DocumentNode &operator=(const DocumentNode &) = delete;
+            ~DocumentNode();
+
+            const Source &source() const {
+                return this->tokens->source;
+            }
+
+            OperationDefinitionNode *get_operation(std::string operation_name = "") {
+                OperationDefinitionNode *operation = nullptr;
+                for (auto definition : this->definitions) {
+                    if (definition->kind != OPERATION_DEFINITION)
+                        continue;
+                    OperationDefinitionNode *candidate = static_cast<OperationDefinitionNode *>(definition);
+                    if (!operation_name.empty()) {
+                        if (candidate->name == operation_name)
+                            return candidate;
+                    } else if (operation != nullptr) {
+                        throw GraphQLError("Must provide operation name if query contains multiple operations.");
+                    } else {
+                        operation = candidate;
+                    }
+                }
+                if (operation == nullptr)
+                    throw GraphQLError(operation_name.empty() ? "Must provide an operation." : fmt::format("Unknown operation named \"{}\".", operation_name));
+                return operation;
+            }
+
+            FragmentDefinitionNode *get_fragment(const std::string &name) const {
+                for (auto fragment : this->fragments)
+                    if (fragment->name == name)
+                        return fragment;
+                return nullptr;
+            }
+
+            // Argument plan for the named operation, built on first use and cached. Safe to call
+            // from several threads once the document is parsed.
+            ArgumentPlan *argument_plan(std::string operation_name = "");
+
+            // Field planner for this document against one set of possible types, created on first
+            // use and cached. possible_types must outlive the document.
+            FieldPlanner *field_planner(const PossibleTypes &possible_types);
+
+            // Drops every cached plan.
+            void clear_plans();
+    };
+
+    std::string token_kind_description(TokenKind kind) {
+        if (punctuator_token_kinds.count(kind) > 0)
+            return fmt::format("\"{}\"", token_kind_value(kind));
+        return token_kind_value(kind);
+    }
+
+    // Free lists of nodes, one per node class, so a parser can hand out nodes of recycled
+    // documents instead of allocating.
+    template <class... T>
+    class NodePool {
+        private:
+            std::tuple<std::vector<T *>...> free_nodes;
+
+            template <class U>
+            bool give_as(Node *node) {
+                if (typeid(*node) != typeid(U))
+                    return false;
+                std::get<std::vector<U *>>(this->free_nodes).push_back(static_cast<U *>(node));
+                return true;
+            }
+
+            template <class U>
+            void delete_all() {
+                for (auto node : std::get<std::vector<U *>>(this->free_nodes))
+                    delete node;
+            }
+        public:
+            NodePool() { }
+            NodePool(const NodePool &) = delete;
+            NodePool &operator=(const NodePool &) = delete;
+
+            ~NodePool() {
+                (this->delete_all<T>(), ...);
+            }
+
+            template <class U>
+            U *take() {
+                std::vector<U *> &free_nodes = std::get<std::vector<U *>>(this->free_nodes);
+                if (free_nodes.empty())
+                    return new U();
+                U *node = free_nodes.back();
+                free_nodes.pop_back();
+                node->clear();
+                return node;
+            }
+
+            // Nodes of other classes are deleted.
+            void give(Node *node) {
+                if (!(this->give_as<T>(node) || ...))
+                    delete node;
+            }
+    };
+
+    typedef NodePool<ValueNode, ObjectFieldNode, ArgumentNode, DirectiveNode, TypeNode, SelectionSetNode, FieldNode, FragmentSpreadNode,
+            InlineFragmentNode, VariableDefinitionNode, OperationDefinitionNode, FragmentDefinitionNode, InputValueDefinitionNode,
+            FieldDefinitionNode, EnumValueDefinitionNode, SchemaDefinitionNode, TypeDefinitionNode, DirectiveDefinitionNode> DocumentNodePool;
+
+    // Recursive descent parser for executable and type system documents over a TokenBuffer, mirroring the
+    // graphql-js parser and its error messages. A parser can be reset to a new source and given
+    // its documents back with recycle(); it then reuses their nodes, its token buffer and its
+    // string buffers, and stops allocating once they have grown to fit. Reset to an edit of a
+    // document, it re-lexes around the edit and keeps the definitions the edit does not touch.
+    class Parser {
+        private:
+            std::shared_ptr<TokenBuffer> tokens;
+            TokenCursor cursor;
+            // Decodes string literals through its scratch buffers.
+            Lexer lexer;
+            DocumentNode *document;
+            DocumentNode *spare_document;
+            DocumentNodePool pool;
+            int last_end;
+
+            // A top-level definition of an edited document that parse_document() may take over. Its
+            // range is the one it was parsed at, and shift moves it to where it now lies.
+            class ReusableDefinition {
+                public:
+                    DefinitionNode *definition;
+                    int start;
+                    int end;
+                    int shift;
+                    bool reused;
+            };
+            std::vector<ReusableDefinition> reusable;
+            size_t next_reusable;
+            // Every node of the edited document, until parse_document() sorts out which it reuses.
+            std::vector<Node *> reusable_nodes;
+
+            // The definition of the edited document that starts at the cursor, if there is one whose
+            // tokens and the token after them are unchanged. The cursor is moved past it.
+            DefinitionNode *reuse_definition() {
+                int start = this->cursor.start();
+                while (this->next_reusable < this->reusable.size()) {
+                    ReusableDefinition &candidate = this->reusable[this->next_reusable];
+                    if (candidate.start + candidate.shift > start)
+                        return nullptr;
+                    this->next_reusable += 1;
+                    if (candidate.start + candidate.shift == start) {
+                        candidate.reused = true;
+                        this->last_end = candidate.end + candidate.shift;
+                        this->cursor = TokenCursor(this->tokens.get(), this->tokens->token_at(this->last_end));
+                        if (candidate.definition->kind == FRAGMENT_DEFINITION)
+                            this->document->fragments.push_back(static_cast<FragmentDefinitionNode *>(candidate.definition));
+                        return candidate.definition;
+                    }
+                }
+                return nullptr;
+            }
+
+            // Moves the nodes of reused definitions into the document at their new positions and
+            // gives the others to the pool.
+            void take_reused_nodes(DocumentNode *document) {
+                for (auto node : this->reusable_nodes) {
+                    auto candidate = std::upper_bound(this->reusable.begin(), this->reusable.end(), node->start,
+                            [](int start, const ReusableDefinition &candidate) { return start < candidate.start; });
+                    if (candidate != this->reusable.begin() && (candidate - 1)->reused && node->start < (candidate - 1)->end) {
+                        node->start += (candidate - 1)->shift;
+                        node->end += (candidate - 1)->shift;
+                        document->nodes.push_back(node);
+                    } else {
+                        this->pool.give(node);
+                    }
+                }
+                this->reusable_nodes.clear();
+                this->reusable.clear();
+                this->next_reusable = 0;
+            }
+
+            template <class T>
+            T *create(int start) {
+                T *node = this->pool.take<T>();
+                node->start = start;
+                this->document->nodes.push_back(node);
+                return node;
+            }
+
+            template <class T>
+            T *finish(T *node) {
+                node->end = this->last_end;
+                return node;
+            }
+
+            void advance() {
+                this->last_end = this->cursor.end();
+                this->cursor.advance();
+            }
+
+            bool peek(TokenKind kind) const {
+                return this->cursor.kind() == kind;
+            }
+
+            bool peek_keyword(std::string_view value) const {
+                return this->cursor.kind() == TokenKind::NAME && this->cursor.text() == value;
+            }
+
+            std::string token_description() const {
+                return this->token_description(this->cursor.position());
+            }
+
+            std::string token_description(size_t index) const {
+                TokenKind kind = this->tokens->kind(index);
+                std::string description = token_kind_description(kind);
+                if (kind == TokenKind::NAME || kind == TokenKind::INT || kind == TokenKind::FLOAT || kind == TokenKind::STRING || kind == TokenKind::BLOCK_STRING)
+                    description += fmt::format(" \"{}\"", this->tokens->value(index));
+                return description;
+            }
+
+            GraphQLSyntaxError unexpected() const {
+                return this->unexpected(this->cursor.position());
+            }
+
+            GraphQLSyntaxError unexpected(size_t index) const {
+                return GraphQLSyntaxError(&this->tokens->source, this->tokens->start(index), fmt::format("Unexpected {}.", this->token_description(index)));
+            }
+
+            void expect_token(TokenKind kind) {
+                if (!this->peek(kind))
+                    throw GraphQLSyntaxError(&this->tokens->source, this->cursor.start(), fmt::format("Expected {}, found {}.", token_kind_description(kind), this->token_description()));
+                this->advance();
+            }
+
+            bool expect_optional_token(TokenKind kind) {
+                if (!this->peek(kind))
+                    return false;
+                this->advance();
+                return true;
+            }
+
+            void expect_keyword(std::string_view value) {
+                if (!this->peek_keyword(value))
+                    throw GraphQLSyntaxError(&this->tokens->source, this->cursor.start(), fmt::format("Expected \"{}\", found {}.", value, this->token_description()));
+                this->advance();
+            }
+
+            bool expect_optional_keyword(std::string_view value) {
+                if (!this->peek_keyword(value))
+                    return false;
+                this->advance();
+                return true;
+            }
+
+            void parse_name(std::string &name) {
+                if (!this->peek(TokenKind::NAME))
+                    this->expect_token(TokenKind::NAME);
+                name.assign(this->cursor.text());
+                this->advance();
+            }
+        public:
+            Parser(std::shared_ptr<TokenBuffer> tokens) : tokens(tokens), cursor(tokens.get()), lexer(&tokens->source) {
+                this->document = nullptr;
+                this->spare_document = nullptr;
+                this->last_end = 0;
+                this->next_reusable = 0;
+            }
+
+            Parser(Source *source) : Parser(std::make_shared<TokenBuffer>(source)) { }
+
+            // Parses further definitions into an existing document, starting at the given token.
+            Parser(DocumentNode *document, size_t position) : tokens(document->tokens), cursor(tokens.get(), position), lexer(&tokens->source) {
+                this->document = document;
+                this->spare_document = nullptr;
+                this->last_end = 0;
+                this->next_reusable = 0;
+            }
+
+            Parser(const Parser &) = delete;
+            Parser &operator=(const Parser &) = delete;
+
+            ~Parser() {
+                this->take_reused_nodes(nullptr);
+                delete this->spare_document;
+            }
+
+            // Starts over on a new source. The token buffer is re-lexed in place unless a document
+            // still shares it.
+            void reset(Source *source) {
+                this->take_reused_nodes(nullptr);
+                if (this->tokens.use_count() == 1)
+                    this->tokens->reset(source);
+                else
+                    this->tokens = std::make_shared<TokenBuffer>(source);
+                this->cursor = TokenCursor(this->tokens.get());
+                this->lexer.reset(&this->tokens->source);
+                this->document = nullptr;
+                this->last_end = 0;
+            }
+
+            // Starts over on a document parsed earlier with a text edit applied, for editors that
+            // parse again after every change. Its token buffer is re-lexed around the edit, in place
+            // unless something else shares it, and parse_document() then takes over the top-level
+            // definitions the edit leaves alone, shifted to their new positions, instead of parsing
+            // them again. The document is taken back as by recycle().
+            void reset(DocumentNode *document, int offset, int removed_length, std::string inserted) {
+                this->take_reused_nodes(nullptr);
+                // The document, this parser and the local copy may hold the buffer.
+                std::shared_ptr<TokenBuffer> tokens = document->tokens;
+                if (tokens.use_count() > (this->tokens == tokens ? 3 : 2))
+                    tokens = std::make_shared<TokenBuffer>(&tokens->source);
+                std::pair<size_t, size_t> relexed = tokens->apply_edit(offset, removed_length, inserted);
+                int delta = inserted.length() - removed_length;
+                for (auto definition : document->definitions) {
+                    // The token after a definition decides where it ends, so it may only have moved.
+                    size_t next = std::upper_bound(tokens->ends.begin(), tokens->ends.begin() + relexed.first, (uint32_t) definition->end) - tokens->ends.begin();
+                    int shift;
+                    if (next < relexed.first || (next > 0 && next == relexed.first && relexed.first == relexed.second && tokens->end(next - 1) == definition->end))
+                        shift = 0;
+                    else if (relexed.second < tokens->size() && definition->start + delta >= tokens->start(relexed.second))
+                        shift = delta;
+                    else
+                        continue;
+                    this->reusable.push_back(ReusableDefinition{definition, definition->start, definition->end, shift, false});
+                }
+                std::sort(this->reusable.begin(), this->reusable.end(),
+                        [](const ReusableDefinition &a, const ReusableDefinition &b) { return a.start < b.start; });
+                this->reusable_nodes.swap(document->nodes);
+                document->tokens.reset();
+                this->recycle(document);
+
+                this->tokens = tokens;
+                this->cursor = TokenCursor(this->tokens.get());
+                this->lexer.reset(&this->tokens->source);
+                this->document = nullptr;
+                this->last_end = 0;
+            }
+
+            // Takes back a document parsed earlier, by this or any other parser, for its nodes to be
+            // reused. Neither the document nor its nodes or plans may be used afterwards.
+            void recycle(DocumentNode *document) {
+                for (auto node : document->nodes)
+                    this->pool.give(node);
+                document->nodes.clear();
+                document->definitions.clear();
+                document->fragments.clear();
+                document->clear_plans();
+                document->tokens.reset();
+                if (this->spare_document == nullptr)
+                    this->spare_document = document;
+                else
+                    delete document;
+            }
+
+            size_t position() const {
+                return this->cursor.position();
+            }
+
+            // The returned document owns every node and shares the token buffer.
+            DocumentNode *parse_document() {
+                DocumentNode *document = this->spare_document;
+                if (document != nullptr) {
+                    this->spare_document = nullptr;
+                    document->clear();
+                    document->tokens = this->tokens;
+                } else {
+                    document = new DocumentNode(this->tokens);
+                }
+                this->document = document;
+                try {
+                    document->start = this->cursor.start();
+                    do {
+                        DefinitionNode *definition = this->reuse_definition();
+                        document->definitions.push_back(definition != nullptr ? definition : this->parse_definition());
+                    } while (!this->peek(TokenKind::EOF));
+                } catch (...) {
+                    this->take_reused_nodes(document);
+                    this->recycle(document);
+                    throw;
+                }
+                this->take_reused_nodes(document);
+                return this->finish(document);
+            }
+
+            DefinitionNode *parse_definition() {
+                if (this->peek(TokenKind::BRACE_L))
+                    return this->parse_operation_definition();
+                if (this->peek(TokenKind::NAME)) {
+                    if (this->peek_keyword("query") || this->peek_keyword("mutation") || this->peek_keyword("subscription"))
+                        return this->parse_operation_definition();
+                    if (this->peek_keyword("fragment"))
+                        return this->parse_fragment_definition();
+                    if (this->peek_keyword("extend"))
+                        return this->parse_type_system_extension();
+                }
+                if (this->peek(TokenKind::NAME) || this->peek_description())
+                    return this->parse_type_system_definition();
+                throw this->unexpected();
+            }
+
+            OperationDefinitionNode *parse_operation_definition() {
+                OperationDefinitionNode *operation = this->create<OperationDefinitionNode>(this->cursor.start());
+                if (this->peek(TokenKind::BRACE_L)) {
+                    operation->selection_set = this->parse_selection_set();
+                    return this->finish(operation);
+                }
+                operation->operation = this->parse_operation_type();
+                if (this->peek(TokenKind::NAME))
+                    this->parse_name(operation->name);
+                this->parse_variable_definitions(operation->variable_definitions);
+                this->parse_directives(false, operation->directives);
+                operation->selection_set = this->parse_selection_set();
+                return this->finish(operation);
+            }
+
+            OperationType parse_operation_type() {
+                if (this->expect_optional_keyword("query"))
+                    return QUERY;
+                if (this->expect_optional_keyword("mutation"))
+                    return MUTATION;
+                if (this->expect_optional_keyword("subscription"))
+                    return SUBSCRIPTION;
+                throw this->unexpected();
+            }
+
+            void parse_variable_definitions(std::vector<VariableDefinitionNode *> &definitions) {
+                if (this->expect_optional_token(TokenKind::PAREN_L)) {
+                    do {
+                        definitions.push_back(this->parse_variable_definition());
+                    } while (!this->expect_optional_token(TokenKind::PAREN_R));
+                }
+            }
+
+            VariableDefinitionNode *parse_variable_definition() {
+                VariableDefinitionNode *definition = this->create<VariableDefinitionNode>(this->cursor.start());
+                this->expect_token(TokenKind::DOLLAR);
+                this->parse_name(definition->name);
+                this->expect_token(TokenKind::COLON);
+                definition->type = this->parse_type_reference();
+                if (this->expect_optional_token(TokenKind::EQUALS))
+                    definition->default_value = this->parse_value_literal(true);
+                this->parse_directives(true, definition->directives);
+                return this->finish(definition);
+            }
+
+            SelectionSetNode *parse_selection_set() {
+                SelectionSetNode *selection_set = this->create<SelectionSetNode>(this->cursor.start());
+                this->expect_token(TokenKind::BRACE_L);
+                do {
+                    selection_set->selections.push_back(this->parse_selection());
+                } while (!this->expect_optional_token(TokenKind::BRACE_R));
+                return this->finish(selection_set);
+            }
+
+            SelectionNode *parse_selection() {
+                return this->peek(TokenKind::SPREAD) ? this->parse_fragment() : this->parse_field();
+            }
+
+            FieldNode *parse_field() {
+                FieldNode *field = this->create<FieldNode>(this->cursor.start());
+                this->parse_name(field->name);
+                if (this->expect_optional_token(TokenKind::COLON)) {
+                    field->alias.swap(field->name);
+                    this->parse_name(field->name);
+                }
+                this->parse_arguments(false, field->arguments);
+                this->parse_directives(false, field->directives);
+                if (this->peek(TokenKind::BRACE_L))
+                    field->selection_set = this->parse_selection_set();
+                return this->finish(field);
+            }
+
+            void parse_arguments(bool is_const, std::vector<ArgumentNode *> &arguments) {
+                if (this->expect_optional_token(TokenKind::PAREN_L)) {
+                    do {
+                        ArgumentNode *argument = this->create<ArgumentNode>(this->cursor.start());
+                        this->parse_name(argument->name);
+                        this->expect_token(TokenKind::COLON);
+                        argument->value = this->parse_value_literal(is_const);
+                        arguments.push_back(this->finish(argument));
+                    } while (!this->expect_optional_token(TokenKind::PAREN_R));
+                }
+            }
+
+            SelectionNode *parse_fragment() {
+                int start = this->cursor.start();
+                this->expect_token(TokenKind::SPREAD);
+                bool has_type_condition = this->expect_optional_keyword("on");
+                if (!has_type_condition && this->peek(TokenKind::NAME)) {
+                    FragmentSpreadNode *spread = this->create<FragmentSpreadNode>(start);
+                    this->parse_fragment_name(spread->name);
+                    this->parse_directives(false, spread->directives);
+                    return this->finish(spread);
+                }
+                InlineFragmentNode *fragment = this->create<InlineFragmentNode>(start);
+                if (has_type_condition)
+                    this->parse_name(fragment->type_condition);
+                this->parse_directives(false, fragment->directives);
+                fragment->selection_set = this->parse_selection_set();
+                return this->finish(fragment);
+            }
+
+            FragmentDefinitionNode *parse_fragment_definition() {
+                FragmentDefinitionNode *fragment = this->create<FragmentDefinitionNode>(this->cursor.start());
+                this->expect_keyword("fragment");
+                this->parse_fragment_name(fragment->name);
+                this->expect_keyword("on");
+                this->parse_name(fragment->type_condition);
+                this->parse_directives(false, fragment->directives);
+                fragment->selection_set = this->parse_selection_set();
+                this->document->fragments.push_back(fragment);
+                return this->finish(fragment);
+            }
+
+            void parse_fragment_name(std::string &name) {
+                if (this->peek_keyword("on"))
+                    throw this->unexpected();
+                this->parse_name(name);
+            }
+
+            ValueNode *parse_value_literal(bool is_const) {
+                ValueNode *value = this->create<ValueNode>(this->cursor.start());
+                switch (this->cursor.kind()) {
+                    case TokenKind::BRACKET_L:
+                        value->kind = LIST_VALUE;
+                        this->advance();
+                        while (!this->expect_optional_token(TokenKind::BRACKET_R))
+                            value->values.push_back(this->parse_value_literal(is_const));
+                        return this->finish(value);
+                    case TokenKind::BRACE_L:
+                        value->kind = OBJECT_VALUE;
+                        this->advance();
+                        while (!this->expect_optional_token(TokenKind::BRACE_R)) {
+                            ObjectFieldNode *field = this->create<ObjectFieldNode>(this->cursor.start());
+                            this->parse_name(field->name);
+                            this->expect_token(TokenKind::COLON);
+                            field->value = this->parse_value_literal(is_const);
+                            value->fields.push_back(this->finish(field));
+                        }
+                        return this->finish(value);
+                    case TokenKind::INT:
+                        value->kind = INT_VALUE;
+                        value->value = this->cursor.text();
+                        this->advance();
+                        return this->finish(value);
+                    case TokenKind::FLOAT:
+                        value->kind = FLOAT_VALUE;
+                        value->value = this->cursor.text();
+                        this->advance();
+                        return this->finish(value);
+                    case TokenKind::STRING:
+                    case TokenKind::BLOCK_STRING:
+                        value->kind = STRING_VALUE;
+                        this->lexer.read_value(this->cursor.start(), value->value);
+                        value->block = this->peek(TokenKind::BLOCK_STRING);
+                        this->advance();
+                        return this->finish(value);
+                    case TokenKind::NAME:
+                        if (this->peek_keyword("true") || this->peek_keyword("false"))
+                            value->kind = BOOLEAN_VALUE;
+                        else if (this->peek_keyword("null"))
+                            value->kind = NULL_VALUE;
+                        else
+                            value->kind = ENUM_VALUE;
+                        value->value = this->cursor.text();
+                        this->advance();
+                        return this->finish(value);
+                    case TokenKind::DOLLAR:
+                        if (!is_const) {
+                            value->kind = VARIABLE;
+                            this->advance();
+                            this->parse_name(value->value);
+                            return this->finish(value);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                throw this->unexpected();
+            }
+
+            void parse_directives(bool is_const, std::vector<DirectiveNode *> &directives) {
+                while (this->peek(TokenKind::AT)) {
+                    DirectiveNode *directive = this->create<DirectiveNode>(this->cursor.start());
+                    this->advance();
+                    this->parse_name(directive->name);
+                    this->parse_arguments(is_const, directive->arguments);
+                    directives.push_back(this->finish(directive));
+                }
+            }
+
+            TypeNode *parse_type_reference() {
+                int start = this->cursor.start();
+                TypeNode *type = this->create<TypeNode>(start);
+                if (this->expect_optional_token(TokenKind::BRACKET_L)) {
+                    type->kind = LIST_TYPE;
+                    type->type = this->parse_type_reference();
+                    this->expect_token(TokenKind::BRACKET_R);
+                } else {
+                    this->parse_name(type->name);
+                }
+                this->finish(type);
+                if (this->expect_optional_token(TokenKind::BANG)) {
+                    TypeNode *non_null = this->create<TypeNode>(start);
+                    non_null->kind = NON_NULL_TYPE;
+                    non_null->type = type;
+                    return this->finish(non_null);
+                }
+                return type;
+            }
+
+            bool peek_description() const {
+                return this->peek(TokenKind::STRING) || this->peek(TokenKind::BLOCK_STRING);
+            }
+
+            void parse_description(std::string &description) {
+                if (this->peek_description()) {
+                    this->lexer.read_value(this->cursor.start(), description);
+                    this->advance();
+                }
+            }
+
+            // Kind of the named type definition a keyword starts, or DIRECTIVE_DEFINITION if it starts none.
+            static DefinitionKind type_definition_kind(std::string_view keyword) {
+                if (keyword == "scalar")
+                    return SCALAR_TYPE_DEFINITION;
+                if (keyword == "type")
+                    return OBJECT_TYPE_DEFINITION;
+                if (keyword == "interface")
+                    return INTERFACE_TYPE_DEFINITION;
+                if (keyword == "union")
+                    return UNION_TYPE_DEFINITION;
+                if (keyword == "enum")
+                    return ENUM_TYPE_DEFINITION;
+                if (keyword == "input")
+                    return INPUT_OBJECT_TYPE_DEFINITION;
+                return DIRECTIVE_DEFINITION;
+            }
+
+            DefinitionNode *parse_type_system_definition() {
+                size_t keyword = this->cursor.position() + (this->peek_description() ? 1 : 0);
+                std::string_view value = this->tokens->kind(keyword) == TokenKind::NAME ? this->tokens->text(keyword) : "";
+                if (value == "schema")
+                    return this->parse_schema_definition(false);
+                if (value == "directive")
+                    return this->parse_directive_definition();
+                DefinitionKind kind = type_definition_kind(value);
+                if (kind != DIRECTIVE_DEFINITION)
+                    return this->parse_type_definition(kind, false);
+                throw this->unexpected(keyword);
+            }
+
+            DefinitionNode *parse_type_system_extension() {
+                size_t keyword = this->cursor.position() + 1;
+                std::string_view value = this->tokens->kind(keyword) == TokenKind::NAME ? this->tokens->text(keyword) : "";
+                if (value == "schema")
+                    return this->parse_schema_definition(true);
+                DefinitionKind kind = type_definition_kind(value);
+                if (kind != DIRECTIVE_DEFINITION)
+                    return this->parse_type_definition(kind, true);
+                throw this->unexpected(keyword);
+            }
+
+            SchemaDefinitionNode *parse_schema_definition(bool extension) {
+                SchemaDefinitionNode *schema = this->create<SchemaDefinitionNode>(this->cursor.start());
+                schema->extension = extension;
+                if (extension)
+                    this->expect_keyword("extend");
+                else
+                    this->parse_description(schema->description);
+                this->expect_keyword("schema");
+                this->parse_directives(true, schema->directives);
+                if (!extension || this->peek(TokenKind::BRACE_L)) {
+                    this->expect_token(TokenKind::BRACE_L);
+                    do {
+                        OperationType operation = this->parse_operation_type();
+                        this->expect_token(TokenKind::COLON);
+                        schema->operation_types.emplace_back(operation, "");
+                        this->parse_name(schema->operation_types.back().second);
+                    } while (!this->expect_optional_token(TokenKind::BRACE_R));
+                }
+                if (extension && schema->directives.empty() && schema->operation_types.empty())
+                    throw this->unexpected();
+                return this->finish(schema);
+            }
+
+            TypeDefinitionNode *parse_type_definition(DefinitionKind kind, bool extension) {
+                TypeDefinitionNode *type = this->create<TypeDefinitionNode>(this->cursor.start());
+                type->kind = kind;
+                type->extension = extension;
+                if (extension)
+                    this->expect_keyword("extend");
+                else
+                    this->parse_description(type->description);
+                this->advance();
+                this->parse_name(type->name);
+                if ((kind == OBJECT_TYPE_DEFINITION || kind == INTERFACE_TYPE_DEFINITION) && this->expect_optional_keyword("implements")) {
+                    this->expect_optional_token(TokenKind::AMP);
+                    do {
+                        type->interfaces.emplace_back();
+                        this->parse_name(type->interfaces.back());
+                    } while (this->expect_optional_token(TokenKind::AMP));
+                }
+                this->parse_directives(true, type->directives);
+                switch (kind) {
+                    case OBJECT_TYPE_DEFINITION:
+                    case INTERFACE_TYPE_DEFINITION:
+                        if (this->expect_optional_token(TokenKind::BRACE_L)) {
+                            do {
+                                type->fields.push_back(this->parse_field_definition());
+                            } while (!this->expect_optional_token(TokenKind::BRACE_R));
+                        }
+                        break;
+                    case UNION_TYPE_DEFINITION:
+                        if (this->expect_optional_token(TokenKind::EQUALS)) {
+                            this->expect_optional_token(TokenKind::PIPE);
+                            do {
+                                type->types.emplace_back();
+                                this->parse_name(type->types.back());
+                            } while (this->expect_optional_token(TokenKind::PIPE));
+                        }
+                        break;
+                    case ENUM_TYPE_DEFINITION:
+                        if (this->expect_optional_token(TokenKind::BRACE_L)) {
+                            do {
+                                EnumValueDefinitionNode *value = this->create<EnumValueDefinitionNode>(this->cursor.start());
+                                this->parse_description(value->description);
+                                this->parse_name(value->name);
+                                this->parse_directives(true, value->directives);
+                                type->values.push_back(this->finish(value));
+                            } while (!this->expect_optional_token(TokenKind::BRACE_R));
+                        }
+                        break;
+                    case INPUT_OBJECT_TYPE_DEFINITION:
+                        if (this->expect_optional_token(TokenKind::BRACE_L)) {
+                            do {
+                                type->input_fields.push_back(this->parse_input_value_definition());
+                            } while (!this->expect_optional_token(TokenKind::BRACE_R));
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                if (extension && type->interfaces.empty() && type->directives.empty() && type->fields.empty() && type->types.empty()
+                        && type->values.empty() && type->input_fields.empty())
+                    throw this->unexpected();
+                return this->finish(type);
+            }
+
+            FieldDefinitionNode *parse_field_definition() {
+                FieldDefinitionNode *field = this->create<FieldDefinitionNode>(this->cursor.start());
+                this->parse_description(field->description);
+                this->parse_name(field->name);
+                this->parse_argument_definitions(field->arguments);
+                this->expect_token(TokenKind::COLON);
+                field->type = this->parse_type_reference();
+                this->parse_directives(true, field->directives);
+                return this->finish(field);
+            }
+
+            void parse_argument_definitions(std::vector<InputValueDefinitionNode *> &arguments) {
+                if (this->expect_optional_token(TokenKind::PAREN_L)) {
+                    do {
+                        arguments.push_back(this->parse_input_value_definition());
+                    } while (!this->expect_optional_token(TokenKind::PAREN_R));
+                }
+            }
+
+            InputValueDefinitionNode *parse_input_value_definition() {
+                InputValueDefinitionNode *value = this->create<InputValueDefinitionNode>(this->cursor.start());
+                this->parse_description(value->description);
+                this->parse_name(value->name);
+                this->expect_token(TokenKind::COLON);
+                value->type = this->parse_type_reference();
+                if (this->expect_optional_token(TokenKind::EQUALS))
+                    value->default_value = this->parse_value_literal(true);
+                this->parse_directives(true, value->directives);
+                return this->finish(value);
+            }
+
+            DirectiveDefinitionNode *parse_directive_definition() {
+                DirectiveDefinitionNode *directive = this->create<DirectiveDefinitionNode>(this->cursor.start());
+                this->parse_description(directive->description);
+                this->expect_keyword("directive");
+                this->expect_token(TokenKind::AT);
+                this->parse_name(directive->name);
+                this->parse_argument_definitions(directive->arguments);
+                directive->repeatable = this->expect_optional_keyword("repeatable");
+                this->expect_keyword("on");
+                this->expect_optional_token(TokenKind::PIPE);
+                do {
+                    size_t location = this->cursor.position();
+                    directive->locations.emplace_back();
+                    this->parse_name(directive->locations.back());
+                    if (std::find(directive_locations.begin(), directive_locations.end(), directive->locations.back()) == directive_locations.end())
+                        throw this->unexpected(location);
+                } while (this->expect_optional_token(TokenKind::PIPE));
+                return this->finish(directive);
+            }
+    };
+
+    DocumentNode *parse(Source *source) {
+        Parser parser(source);
+        return parser.parse_document();
+    }
+
+    // Per-thread pools of lexers and parsers. acquire() hands out an instance reset to the given
+    // source, keeping every buffer it grew while serving earlier requests on the same thread.
+    // release() returns it once its tokens are no longer used; for a parser, also pass the
+    // document it produced to have the nodes reused.
+    class LexerPool {
+        private:
+            static std::vector<std::unique_ptr<Lexer>> &instances() {
+                thread_local std::vector<std::unique_ptr<Lexer>> instances;
+                return instances;
+            }
+        public:
+            static Lexer *acquire(Source *source, bool recover = false) {
+                std::vector<std::unique_ptr<Lexer>> &instances = LexerPool::instances();
+                if (instances.empty())
+                    return new Lexer(source, recover);
+                Lexer *lexer = instances.back().release();
+                instances.pop_back();
+                lexer->reset(source, recover);
+                return lexer;
+            }
+
+            static void release(Lexer *lexer) {
+                LexerPool::instances().emplace_back(lexer);
+            }
+    };
+
+    class ParserPool {
+        private:
+            static std::vector<std::unique_ptr<Parser>> &instances() {
+                thread_local std::vector<std::unique_ptr<Parser>> instances;
+                return instances;
+            }
+        public:
+            static Parser *acquire(Source *source) {
+                std::vector<std::unique_ptr<Parser>> &instances = ParserPool::instances();
+                if (instances.empty())
+                    return new Parser(source);
+                Parser *parser = instances.back().release();
+                instances.pop_back();
+                try {
+                    parser->reset(source);
+                } catch (...) {
+                    instances.emplace_back(parser);
+                    throw;
+                }
+                return parser;
+            }
+
+            static void release(Parser *parser, DocumentNode *document = nullptr) {
+                if (document != nullptr)
+                    parser->recycle(document);
+                ParserPool::instances().emplace_back(parser);
+            }
+    };
+
+    // Top-level definition found by DocumentIndex, spanning tokens [first_token, end_token).
+    class DefinitionSummary {
+        public:
+            DefinitionKind kind;
+            OperationType operation = QUERY;
+            std::string name;
+            int start;
+            int end;
+            size_t first_token;
+            size_t end_token;
+            // Fragments spread anywhere inside the definition.
+            std::vector<std::string> fragment_spreads;
+    };
+
+    // Index of the top-level definitions of a document, built by skimming its tokens and matching
+    // brackets instead of parsing. parse_operation then parses only the selected operation and
+    // the fragments it transitively spreads, so unused definitions of a large persisted document
+    // cost no more than lexing. Syntax errors inside unused definitions are not reported.
+    class DocumentIndex {
+        private:
+            std::map<std::string, size_t> fragments;
+
+            bool skim() {
+                const TokenBuffer &tokens = *this->tokens;
+                size_t index = 0;
+                while (tokens.kind(index) != TokenKind::EOF) {
+                    DefinitionSummary definition;
+                    definition.first_token = index;
+                    definition.start = tokens.start(index);
+                    if (tokens.kind(index) == TokenKind::BRACE_L) {
+                        definition.kind = OPERATION_DEFINITION;
+                    } else if (tokens.kind(index) == TokenKind::NAME) {
+                        std::string_view keyword = tokens.text(index);
+                        if (keyword == "fragment")
+                            definition.kind = FRAGMENT_DEFINITION;
+                        else if (keyword == "query" || keyword == "mutation" || keyword == "subscription")
+                            definition.kind = OPERATION_DEFINITION;
+                        else
+                            return false;
+                        if (keyword == "mutation")
+                            definition.operation = MUTATION;
+                        else if (keyword == "subscription")
+                            definition.operation = SUBSCRIPTION;
+                        index += 1;
+                        if (tokens.kind(index) == TokenKind::NAME)
+                            definition.name = tokens.text(index);
+                        else if (definition.kind == FRAGMENT_DEFINITION)
+                            return false;
+                    } else {
+                        return false;
+                    }
+
+                    int depth = 0;
+                    while (true) {
+                        TokenKind kind = tokens.kind(index);
+                        if (kind == TokenKind::EOF)
+                            return false;
+                        index += 1;
+                        if (kind == TokenKind::BRACE_L || kind == TokenKind::PAREN_L || kind == TokenKind::BRACKET_L) {
+                            depth += 1;
+                        } else if (kind == TokenKind::BRACE_R || kind == TokenKind::PAREN_R || kind == TokenKind::BRACKET_R) {
+                            depth -= 1;
+                            if (depth < 0)
+                                return false;
+                            if (depth == 0 && kind == TokenKind::BRACE_R)
+                                break;
+                        } else if (kind == TokenKind::SPREAD && tokens.kind(index) == TokenKind::NAME && tokens.text(index) != "on") {
+                            definition.fragment_spreads.emplace_back(tokens.text(index));
+                        }
+                    }
+                    definition.end_token = index;
+                    definition.end = tokens.end(index - 1);
+                    if (definition.kind == FRAGMENT_DEFINITION)
+                        this->fragments.emplace(definition.name, this->definitions.size());
+                    this->definitions.push_back(std::move(definition));
+                }
+                return !this->definitions.empty();
+            }
+        public:
+            std::shared_ptr<TokenBuffer> tokens;
+            std::vector<DefinitionSummary> definitions;
+            // False when the skim could not make sense of the document. parse_operation then
+            // parses all of it, which also reports the syntax error.
+            bool complete;
+
+            DocumentIndex(Source *source) : tokens(std::make_shared<TokenBuffer>(source)) {
+                this->complete = this->skim();
+            }
+
+            const DefinitionSummary *get_operation(std::string operation_name = "") const {
+                const DefinitionSummary *operation = nullptr;
+                for (auto &definition : this->definitions) {
+                    if (definition.kind != OPERATION_DEFINITION)
+                        continue;
+                    if (!operation_name.empty()) {
+                        if (definition.name == operation_name)
+                            return &definition;
+                    } else if (operation != nullptr) {
+                        throw GraphQLError("Must provide operation name if query contains multiple operations.");
+                    } else {
+                        operation = &definition;
+                    }
+                }
+                if (operation == nullptr)
+                    throw GraphQLError(operation_name.empty() ? "Must provide an operation." : fmt::format("Unknown operation named \"{}\".", operation_name));
+                return operation;
+            }
+
+            // Parses the selected operation and the fragments it needs into a new document, keeping
+            // their order in the source.
+            DocumentNode *parse_operation(std::string operation_name = "") const {
+                if (!this->complete)
+                    return Parser(this->tokens).parse_document();
+
+                std::vector<bool> selected(this->definitions.size());
+                std::vector<size_t> pending{static_cast<size_t>(this->get_operation(operation_name) - this->definitions.data())};
+                while (!pending.empty()) {
+                    size_t index = pending.back();
+                    pending.pop_back();
+                    if (selected[index])
+                        continue;
+                    selected[index] = true;
+                    for (auto &name : this->definitions[index].fragment_spreads) {
+                        auto fragment = this->fragments.find(name);
+                        if (fragment != this->fragments.end())
+                            pending.push_back(fragment->second);
+                    }
+                }
+
+                DocumentNode *document = new DocumentNode(this->tokens);
+                document->start = this->definitions.front().start;
+                document->end = this->definitions.back().end;
+                try {
+                    for (size_t index = 0; index < this->definitions.size(); index++) {
+                        if (!selected[index])
+                            continue;
+                        Parser parser(document, this->definitions[index].first_token);
+                        document->definitions.push_back(parser.parse_definition());
+                        if (parser.position() != this->definitions[index].end_token) {
+                            // The skim disagrees with the grammar; let the full parse decide.
+                            delete document;
+                            return Parser(this->tokens).parse_document();
+                        }
+                    }
+                } catch (...) {
+                    delete document;
+                    throw;
+                }
+                return document;
+            }
+    };
+
+    // Input value used at execution time: a coerced variable or an argument literal converted once
+    // when the plan is built. VARIABLE values only appear inside plans, with the variable's slot in
+    // int_value.
+    class Value {
+        public:
+            ValueKind kind = NULL_VALUE;
+            int64_t int_value = 0;
+            double float_value = 0;
+            bool boolean_value = false;
+            // String contents or enum name.
+            std::string string_value;
+            std::vector<Value> list_value;
+            std::vector<std::pair<std::string, Value>> object_value;
+
+            static Value null() {
+                return Value();
+            }
+
+            static Value integer(int64_t value) {
+                Value result;
+                result.kind = INT_VALUE;
+                result.int_value = value;
+                return result;
+            }
+
+            static Value floating(double value) {
+                Value result;
+                result.kind = FLOAT_VALUE;
+                result.float_value = value;
+                return result;
+            }
+
+            static Value boolean(bool value) {
+                Value result;
+                result.kind = BOOLEAN_VALUE;
+                result.boolean_value = value;
+                return result;
+            }
+
+            static Value string(std::string value) {
+                Value result;
+                result.kind = STRING_VALUE;
+                result.string_value = std::move(value);
+                return result;
+            }
+
+            static Value enumeration(std::string value) {
+                Value result;
+                result.kind = ENUM_VALUE;
+                result.string_value = std::move(value);
+                return result;
+            }
+
+            static Value list(std::vector<Value> values) {
+                Value result;
+                result.kind = LIST_VALUE;
+                result.list_value = std::move(values);
+                return result;
+            }
+
+            static Value object(std::vector<std::pair<std::string, Value>> fields) {
+                Value result;
+                result.kind = OBJECT_VALUE;
+                result.object_value = std::move(fields);
+                return result;
+            }
+
+            static Value variable(int slot) {
+                Value result;
+                result.kind = VARIABLE;
+                result.int_value = slot;
+                return result;
+            }
+
+            friend bool operator==(const Value &lhs, const Value &rhs);
+    };
+
+    bool operator==(const Value &lhs, const Value &rhs) {
+        if (lhs.kind != rhs.kind)
+            return false;
+        switch (lhs.kind) {
+            case INT_VALUE:
+            case VARIABLE:
+                return lhs.int_value == rhs.int_value;
+            case FLOAT_VALUE:
+                return lhs.float_value == rhs.float_value;
+            case BOOLEAN_VALUE:
+                return lhs.boolean_value == rhs.boolean_value;
+            case STRING_VALUE:
+            case ENUM_VALUE:
+                return lhs.string_value == rhs.string_value;
+            case LIST_VALUE:
+                return lhs.list_value == rhs.list_value;
+            case OBJECT_VALUE:
+                return lhs.object_value == rhs.object_value;
+            default:
+                return true;
+        }
+    }
+
+    std::string escape_string(const std::string &value) {
+        std::string escaped;
+        for (char character : value) {
+            switch (character) {
+                case '"':
+                case '\\':
+                    escaped += '\\';
+                    escaped += character;
+                    break;
+                case '\b':
+                    escaped += "\\b";
+                    break;
+                case '\f':
+                    escaped += "\\f";
+                    break;
+                case '\n':
+                    escaped += "\\n";
+                    break;
+                case '\r':
+                    escaped += "\\r";
+                    break;
+                case '\t':
+                    escaped += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(character) < ' ')
+                        escaped += fmt::format("\\u{:04X}", static_cast<int>(character));
+                    else
+                        escaped += character;
+            }
+        }
+        return escaped;
+    }
+
+    // Prints the value in GraphQL literal syntax, as used in error messages.
+    std::string print_value(const Value &value) {
+        switch (value.kind) {
+            case INT_VALUE:
+                return std::to_string(value.int_value);
+            case FLOAT_VALUE:
+                return fmt::format("{}", value.float_value);
+            case BOOLEAN_VALUE:
+                return value.boolean_value ? "true" : "false";
+            case STRING_VALUE:
+                return fmt::format("\"{}\"", escape_string(value.string_value));
+            case ENUM_VALUE:
+                return value.string_value;
+            case VARIABLE:
+                return fmt::format("${}", value.int_value);
+            case LIST_VALUE: {
+                std::vector<std::string> items;
+                for (auto &item : value.list_value)
+                    items.push_back(print_value(item));
+                return fmt::format("[{}]", fmt::join(items, ", "));
+            }
+            case OBJECT_VALUE: {
+                std::vector<std::string> fields;
+                for (auto &field : value.object_value)
+                    fields.push_back(fmt::format("{}: {}", field.first, print_value(field.second)));
+                return fmt::format("{{{}}}", fmt::join(fields, ", "));
+            }
+            default:
+                return "null";
+        }
+    }
+
+    // Prints a literal from the AST the way print_value prints values.
+    std::string print_value_node(const ValueNode *value) {
+        switch (value->kind) {
+            case VARIABLE:
+                return fmt::format("${}", value->value);
+            case STRING_VALUE:
+                return fmt::format("\"{}\"", escape_string(value->value));
+            case LIST_VALUE: {
+                std::vector<std::string> items;
+                for (auto item : value->values)
+                    items.push_back(print_value_node(item));
+                return fmt::format("[{}]", fmt::join(items, ", "));
+            }
+            case OBJECT_VALUE: {
+                std::vector<std::string> fields;
+                for (auto field : value->fields)
+                    fields.push_back(fmt::format("{}: {}", field->name, print_value_node(field->value)));
+                return fmt::format("{{{}}}", fmt::join(fields, ", "));
+            }
+            default:
+                return value->value;
+        }
+    }
+
+    // Coerces a variable value against one of the built-in scalar types. Other named types are
+    // passed through, since input objects, enums and custom scalars need a schema.
+    Value coerce_scalar(const Value &value, const std::string &type_name, std::string &error) {
+        if (type_name == "Int") {
+            double number = value.kind == INT_VALUE ? value.int_value : value.float_value;
+            if (value.kind != INT_VALUE && !(value.kind == FLOAT_VALUE && number == std::trunc(number)))
+                error = fmt::format("Int cannot represent non-integer value: {}", print_value(value));
+            else if (number < INT32_MIN || number > INT32_MAX)
+                error = fmt::format("Int cannot represent non 32-bit signed integer value: {}", print_value(value));
+            else
+                return Value::integer(static_cast<int64_t>(number));
+        } else if (type_name == "Float") {
+            if (value.kind == INT_VALUE)
+                return Value::floating(value.int_value);
+            if (value.kind == FLOAT_VALUE)
+                return value;
+            error = fmt::format("Float cannot represent non numeric value: {}", print_value(value));
+        } else if (type_name == "String") {
+            if (value.kind == STRING_VALUE)
+                return value;
+            error = fmt::format("String cannot represent a non string value: {}", print_value(value));
+        } else if (type_name == "Boolean") {
+            if (value.kind == BOOLEAN_VALUE)
+                return value;
+            error = fmt::format("Boolean cannot represent a non boolean value: {}", print_value(value));
+        } else if (type_name == "ID") {
+            if (value.kind == STRING_VALUE)
+                return value;
+            if (value.kind == INT_VALUE)
+                return Value::string(std::to_string(value.int_value));
+            error = fmt::format("ID cannot represent value: {}", print_value(value));
+        } else {
+            return value;
+        }
+        return Value::null();
+    }
+
+    Value coerce_input_value(const Value &value, TypeNode *type, std::string &error) {
+        if (type->kind == NON_NULL_TYPE) {
+            if (value.kind == NULL_VALUE) {
+                error = fmt::format("Expected non-nullable type \"{}\" not to be null.", print_type(type));
+                return value;
+            }
+            return coerce_input_value(value, type->type, error);
+        }
+        if (value.kind == NULL_VALUE)
+            return value;
+        if (type->kind == LIST_TYPE) {
+            if (value.kind != LIST_VALUE)
+                return Value::list({coerce_input_value(value, type->type, error)});
+            std::vector<Value> items;
+            for (auto &item : value.list_value) {
+                items.push_back(coerce_input_value(item, type->type, error));
+                if (!error.empty())
+                    break;
+            }
+            return Value::list(std::move(items));
+        }
+        return coerce_scalar(value, type->name, error);
+    }
+
+    class PlannedVariable {
+        public:
+            std::string name;
+            TypeNode *type;
+            std::optional<Value> default_value;
+            int position;
+            int default_position;
+    };
+
+    class PlannedArgument {
+        public:
+            std::string name;
+            // The converted literal. Lists and objects containing variables keep VARIABLE leaves
+            // that are filled in when the plan is resolved.
+            Value value;
+            bool has_variables;
+    };
+
+    class PlannedField {
+        public:
+            FieldNode *node;
+            std::vector<PlannedArgument> arguments;
+    };
+
+    typedef std::vector<std::pair<std::string, Value>> ArgumentValues;
+
+    // Argument values for every field of one operation, precompiled from the AST. Literals are
+    // converted once when the plan is built; resolving it for a request only coerces the variables
+    // and substitutes them, in a single pass over a flat list of fields. Fields reached through
+    // fragments appear once, in document order.
+    //
+    // A plan with literal slots treats Int, Float and String literals like variables instead, so
+    // that it can serve every document with the same signature: their slots follow the variable
+    // slots and are filled from each request's tokens by literal_values().
+    class ArgumentPlan {
+        private:
+            std::map<std::string, int> variable_slots;
+            std::unordered_set<std::string> visited_fragments;
+            // Token index of the document's literal tokens by token start, for literal slots.
+            std::map<int, size_t> literal_indexes;
+
+            // Int literals keep their value whatever the argument's type; the 32-bit range is only
+            // checked when coercing against Int. Past 64 bits they become floats, as numbers do in
+            // graphql-js.
+            static Value int_literal(const std::string &text) {
+                errno = 0;
+                long long number = std::strtoll(text.c_str(), nullptr, 10);
+                if (errno == ERANGE)
+                    return Value::floating(std::strtod(text.c_str(), nullptr));
+                return Value::integer(number);
+            }
+
+            Value literal_value(ValueNode *node, bool &has_variables) {
+                if (!this->literal_indexes.empty() && (node->kind == INT_VALUE || node->kind == FLOAT_VALUE || node->kind == STRING_VALUE)) {
+                    has_variables = true;
+                    this->literals.push_back(this->literal_indexes[node->start]);
+                    return Value::variable(this->operation->variable_definitions.size() + this->literals.size() - 1);
+                }
+                switch (node->kind) {
+                    case VARIABLE: {
+                        auto slot = this->variable_slots.find(node->value);
+                        if (slot == this->variable_slots.end())
+                            throw GraphQLError(fmt::format("Variable \"${}\" is not defined by operation \"{}\".", node->value, this->operation->name),
+                                    &this->document->tokens->source, position_to_position_list(node->start));
+                        has_variables = true;
+                        return Value::variable(slot->second);
+                    }
+                    case INT_VALUE:
+                        return int_literal(node->value);
+                    case FLOAT_VALUE:
+                        return Value::floating(std::strtod(node->value.c_str(), nullptr));
+                    case STRING_VALUE:
+                        return Value::string(node->value);
+                    case BOOLEAN_VALUE:
+                        return Value::boolean(node->value == "true");
+                    case ENUM_VALUE:
+                        return Value::enumeration(node->value);
+                    case LIST_VALUE: {
+                        std::vector<Value> items;
+                        for (auto item : node->values)
+                            items.push_back(this->literal_value(item, has_variables));
+                        return Value::list(std::move(items));
+                    }
+                    case OBJECT_VALUE: {
+                        std::vector<std::pair<std::string, Value>> fields;
+                        for (auto field : node->fields)
+                            fields.emplace_back(field->name, this->literal_value(field->value, has_variables));
+                        return Value::object(std::move(fields));
+                    }
+                    default:
+                        return Value::null();
+                }
+            }
+
+            Value coerce_default(const PlannedVariable &variable, const Value &value) const {
+                std::string error;
+                Value coerced = coerce_input_value(value, variable.type, error);
+                if (!error.empty())
+                    throw GraphQLError(fmt::format("Variable \"${}\" has invalid default value {}; {}", variable.name, print_value(value), error),
+                            &this->document->tokens->source, position_to_position_list(variable.default_position));
+                return coerced;
+            }
+
+            void plan_selection_set(SelectionSetNode *selection_set) {
+                for (auto selection : selection_set->selections) {
+                    if (selection->kind == FIELD) {
+                        FieldNode *field = static_cast<FieldNode *>(selection);
+                        PlannedField planned;
+                        planned.node = field;
+                        for (auto argument : field->arguments) {
+                            bool has_variables = false;
+                            Value value = this->literal_value(argument->value, has_variables);
+                            planned.arguments.push_back(PlannedArgument{argument->name, std::move(value), has_variables});
+                        }
+                        this->field_indexes.emplace(field, this->fields.size());
+                        this->fields.push_back(std::move(planned));
+                        if (field->selection_set != nullptr)
+                            this->plan_selection_set(field->selection_set);
+                    } else if (selection->kind == INLINE_FRAGMENT) {
+                        this->plan_selection_set(static_cast<InlineFragmentNode *>(selection)->selection_set);
+                    } else {
+                        std::string name = static_cast<FragmentSpreadNode *>(selection)->name;
+                        FragmentDefinitionNode *fragment = this->document->get_fragment(name);
+                        if (fragment == nullptr)
+                            throw GraphQLError(fmt::format("Unknown fragment \"{}\".", name), &this->document->tokens->source, position_to_position_list(selection->start));
+                        if (this->visited_fragments.insert(name).second)
+                            this->plan_selection_set(fragment->selection_set);
+                    }
+                }
+            }
+
+            // Replaces VARIABLE leaves. Unset variables become null inside lists and drop the field
+            // inside objects, as in graphql-js.
+            Value bind(const Value &value, const std::vector<std::optional<Value>> &variables) const {
+                if (value.kind == VARIABLE) {
+                    const std::optional<Value> &variable = variables[value.int_value];
+                    return variable ? *variable : Value::null();
+                }
+                if (value.kind == LIST_VALUE) {
+                    std::vector<Value> items;
+                    items.reserve(value.list_value.size());
+                    for (auto &item : value.list_value)
+                        items.push_back(this->bind(item, variables));
+                    return Value::list(std::move(items));
+                }
+                if (value.kind == OBJECT_VALUE) {
+                    std::vector<std::pair<std::string, Value>> fields;
+                    for (auto &field : value.object_value) {
+                        if (field.second.kind == VARIABLE && !variables[field.second.int_value])
+                            continue;
+                        fields.emplace_back(field.first, this->bind(field.second, variables));
+                    }
+                    return Value::object(std::move(fields));
+                }
+                return value;
+            }
+        public:
+            DocumentNode *document;
+            OperationDefinitionNode *operation;
+            std::vector<PlannedVariable> variables;
+            std::vector<PlannedField> fields;
+            std::map<FieldNode *, int> field_indexes;
+            // Token index of each literal slot. Documents with the same signature have the same
+            // token kinds, so the index holds for every request the plan serves.
+            std::vector<size_t> literals;
+
+            ArgumentPlan(DocumentNode *document, OperationDefinitionNode *operation, bool literal_slots = false) {
+                this->document = document;
+                this->operation = operation;
+                if (literal_slots) {
+                    const TokenBuffer &tokens = *document->tokens;
+                    for (size_t index = 0; index < tokens.size(); index++)
+                        if (is_literal_token(tokens.kind(index)))
+                            this->literal_indexes.emplace(tokens.start(index), index);
+                }
+                for (auto definition : operation->variable_definitions) {
+                    PlannedVariable variable{definition->name, definition->type, std::nullopt, definition->start, 0};
+                    if (definition->default_value != nullptr) {
+                        bool has_variables = false;
+                        Value value = this->literal_value(definition->default_value, has_variables);
+                        variable.default_position = definition->default_value->start;
+                        // Defaults with literal slots are coerced once the slots are bound
+                        variable.default_value = has_variables ? std::move(value) : this->coerce_default(variable, value);
+                    }
+                    this->variable_slots.emplace(definition->name, this->variables.size());
+                    this->variables.push_back(std::move(variable));
+                }
+                this->plan_selection_set(operation->selection_set);
+                this->visited_fragments.clear();
+                this->literal_indexes.clear();
+            }
+
+            // Values of the literal slots, read from the tokens of a request with the same
+            // signature as the planned document.
+            std::vector<Value> literal_values(const TokenBuffer &tokens) const {
+                std::vector<Value> values;
+                values.reserve(this->literals.size());
+                for (auto index : this->literals) {
+                    if (index >= tokens.size() || !is_literal_token(tokens.kind(index)))
+                        throw GraphQLError("Request does not match the signature of the plan.");
+                    if (tokens.kind(index) == TokenKind::INT)
+                        values.push_back(int_literal(std::string(tokens.text(index))));
+                    else if (tokens.kind(index) == TokenKind::FLOAT)
+                        values.push_back(Value::floating(std::strtod(std::string(tokens.text(index)).c_str(), nullptr)));
+                    else
+                        values.push_back(Value::string(tokens.value(index)));
+                }
+                return values;
+            }
+
+            // Coerces the request variables against the operation's definitions, one slot per
+            // definition followed by the literal slots. Slots stay empty for variables that were
+            // neither provided nor defaulted.
+            std::vector<std::optional<Value>> coerce_variables(const std::map<std::string, Value> &inputs, const std::vector<Value> &literals = {}) const {
+                if (literals.size() != this->literals.size())
+                    throw GraphQLError(fmt::format("Plan has {} literal slots but {} values were given.", this->literals.size(), literals.size()));
+                std::vector<std::optional<Value>> coerced(this->variables.size() + literals.size());
+                std::copy(literals.begin(), literals.end(), coerced.begin() + this->variables.size());
+                for (size_t slot = 0; slot < this->variables.size(); slot++) {
+                    const PlannedVariable &variable = this->variables[slot];
+                    Source *source = &this->document->tokens->source;
+                    auto input = inputs.find(variable.name);
+                    if (input == inputs.end()) {
+                        if (variable.default_value)
+                            coerced[slot] = this->literals.empty() ? *variable.default_value : this->coerce_default(variable, this->bind(*variable.default_value, coerced));
+                        else if (variable.type->kind == NON_NULL_TYPE)
+                            throw GraphQLError(fmt::format("Variable \"${}\" of required type \"{}\" was not provided.", variable.name, print_type(variable.type)),
+                                    source, position_to_position_list(variable.position));
+                        continue;
+                    }
+                    if (input->second.kind == NULL_VALUE && variable.type->kind == NON_NULL_TYPE)
+                        throw GraphQLError(fmt::format("Variable \"${}\" of non-null type \"{}\" must not be null.", variable.name, print_type(variable.type)),
+                                source, position_to_position_list(variable.position));
+                    std::string error;
+                    coerced[slot] = coerce_input_value(input->second, variable.type, error);
+                    if (!error.empty())
+                        throw GraphQLError(fmt::format("Variable \"${}\" got invalid value {}; {}", variable.name, print_value(input->second), error),
+                                source, position_to_position_list(variable.position));
+                }
+                return coerced;
+            }
+
+            // Argument values for every planned field, indexed like fields. Arguments given as an
+            // unset variable are left out, as graphql-js does.
+            std::vector<ArgumentValues> resolve(const std::map<std::string, Value> &inputs, const std::vector<Value> &literals = {}) const {
+                std::vector<std::optional<Value>> variables = this->coerce_variables(inputs, literals);
+                std::vector<ArgumentValues> values(this->fields.size());
+                for (size_t index = 0; index < this->fields.size(); index++) {
+                    ArgumentValues &arguments = values[index];
+                    arguments.reserve(this->fields[index].arguments.size());
+                    for (auto &argument : this->fields[index].arguments) {
+                        if (!argument.has_variables)
+                            arguments.emplace_back(argument.name, argument.value);
+                        else if (argument.value.kind != VARIABLE || variables[argument.value.int_value])
+                            arguments.emplace_back(argument.name, this->bind(argument.value, variables));
+                    }
+                }
+                return values;
+            }
+
+            // Coerced variables by name, for evaluating @skip and @include conditions.
+            std::map<std::string, Value> variable_values(const std::map<std::string, Value> &inputs, const std::vector<Value> &literals = {}) const {
+                std::vector<std::optional<Value>> coerced = this->coerce_variables(inputs, literals);
+                std::map<std::string, Value> values;
+                for (size_t slot = 0; slot < this->variables.size(); slot++)
+                    if (coerced[slot])
+                        values.emplace(this->variables[slot].name, std::move(*coerced[slot]));
+                return values;
+            }
+
+            int field_index(FieldNode *field) const {
+                auto index = this->field_indexes.find(field);
+                return index == this->field_indexes.end() ? -1 : index->second;
+            }
+    };
+
+    // @skip or @include on a variable. The selection is kept when the variable is include.
+    class FieldCondition {
+        public:
+            std::string variable;
+            bool include;
+
+            friend bool operator==(const FieldCondition &lhs, const FieldCondition &rhs);
+    };
+
+    bool operator==(const FieldCondition &lhs, const FieldCondition &rhs) {
+        return lhs.variable == rhs.variable && lhs.include == rhs.include;
+    }
+
+    class CollectedNode {
+        public:
+            FieldNode *node;
+            // Conditions from the field and every fragment it was reached through.
+            std::vector<FieldCondition> conditions;
+
+            bool included(const std::map<std::string, Value> &variables) const {
+                for (auto &condition : this->conditions) {
+                    auto value = variables.find(condition.variable);
+                    bool set = value != variables.end() && value->second.kind == BOOLEAN_VALUE && value->second.boolean_value;
+                    if (set != condition.include)
+                        return false;
+                }
+                return true;
+            }
+    };
+
+    // All field nodes sharing one response name, in the order graphql-js collects them.
+    class CollectedField {
+        public:
+            std::string response_name;
+            std::vector<CollectedNode> nodes;
+    };
+
+    // Fields of a selection set for one concrete type, with fragment spreads and inline fragments
+    // flattened and literal @skip/@include already applied.
+    class FieldPlan {
+        public:
+            std::string type_name;
+            std::vector<CollectedField> fields;
+            // Whether any node depends on a variable condition. When false, fields is the result
+            // of field collection for every request.
+            bool conditional = false;
+
+            std::vector<const CollectedField *> select(const std::map<std::string, Value> &variables) const {
+                std::vector<const CollectedField *> selected;
+                selected.reserve(this->fields.size());
+                for (auto &field : this->fields) {
+                    if (!this->conditional) {
+                        selected.push_back(&field);
+                        continue;
+                    }
+                    for (auto &node : field.nodes) {
+                        if (node.included(variables)) {
+                            selected.push_back(&field);
+                            break;
+                        }
+                    }
+                }
+                return selected;
+            }
+    };
+
+    // Builds and memoizes field plans keyed by (selection set, fragment or parent field, type), so
+    // per-request field collection becomes a lookup. Fragments are flattened once per type and
+    // reused by every spread of them. Plans live as long as the planner and are safe to share
+    // across threads.
+    class FieldPlanner {
+        private:
+            std::mutex mutex;
+            std::map<std::pair<const void *, std::string>, FieldPlan *> plans;
+            std::unordered_set<std::string> expanding;
+
+            bool applies(const std::string &type_condition, const std::string &type_name) const {
+                if (type_condition.empty() || type_condition == type_name)
+                    return true;
+                auto possible = this->possible_types->find(type_condition);
+                return possible != this->possible_types->end() && possible->second.count(type_name) > 0;
+            }
+
+            // Returns false when a literal condition removes the selection.
+            bool add_conditions(const std::vector<DirectiveNode *> &directives, std::vector<FieldCondition> &conditions) const {
+                for (auto directive : directives) {
+                    if (directive->name != "skip" && directive->name != "include")
+                        continue;
+                    bool include = directive->name == "include";
+                    for (auto argument : directive->arguments) {
+                        if (argument->name != "if")
+                            continue;
+                        if (argument->value->kind == BOOLEAN_VALUE && (argument->value->value == "true") != include)
+                            return false;
+                        if (argument->value->kind == VARIABLE) {
+                            FieldCondition condition{argument->value->value, include};
+                            if (std::find(conditions.begin(), conditions.end(), condition) == conditions.end())
+                                conditions.push_back(condition);
+                        }
+                    }
+                }
+                return true;
+            }
+
+            void add_field(FieldPlan *plan, FieldNode *node, std::vector<FieldCondition> conditions) {
+                const std::string &response_name = node->response_name();
+                auto field = std::find_if(plan->fields.begin(), plan->fields.end(), [&](CollectedField &field) { return field.response_name == response_name; });
+                if (field == plan->fields.end()) {
+                    plan->fields.push_back(CollectedField{response_name, {}});
+                    field = plan->fields.end() - 1;
+                }
+                for (auto &existing : field->nodes)
+                    if (existing.node == node && existing.conditions == conditions)
+                        return;
+                if (!conditions.empty())
+                    plan->conditional = true;
+                field->nodes.push_back(CollectedNode{node, std::move(conditions)});
+            }
+
+            void collect(FieldPlan *plan, SelectionSetNode *selection_set, const std::vector<FieldCondition> &conditions) {
+                for (auto selection : selection_set->selections) {
+                    std::vector<FieldCondition> selection_conditions = conditions;
+                    if (!this->add_conditions(selection->directives, selection_conditions))
+                        continue;
+                    if (selection->kind == FIELD) {
+                        this->add_field(plan, static_cast<FieldNode *>(selection), std::move(selection_conditions));
+                    } else if (selection->kind == INLINE_FRAGMENT) {
+                        InlineFragmentNode *fragment = static_cast<InlineFragmentNode *>(selection);
+                        if (this->applies(fragment->type_condition, plan->type_name))
+                            this->collect(plan, fragment->selection_set, selection_conditions);
+                    } else {
+                        FragmentDefinitionNode *fragment = this->document->get_fragment(static_cast<FragmentSpreadNode *>(selection)->name);
+                        if (fragment == nullptr || !this->applies(fragment->type_condition, plan->type_name) || this->expanding.count(fragment->name) > 0)
+                            continue;
+                        FieldPlan *fragment_plan = this->fragment_plan(fragment, plan->type_name);
+                        for (auto &field : fragment_plan->fields) {
+                            for (auto &node : field.nodes) {
+                                std::vector<FieldCondition> node_conditions = selection_conditions;
+                                for (auto &condition : node.conditions)
+                                    if (std::find(node_conditions.begin(), node_conditions.end(), condition) == node_conditions.end())
+                                        node_conditions.push_back(condition);
+                                this->add_field(plan, node.node, std::move(node_conditions));
+                            }
+                        }
+                    }
+                }
+            }
+
+            FieldPlan *fragment_plan(FragmentDefinitionNode *fragment, const std::string &type_name) {
+                auto key = std::make_pair(static_cast<const void *>(fragment), type_name);
+                auto plan = this->plans.find(key);
+                if (plan != this->plans.end())
+                    return plan->second;
+                FieldPlan *created = new FieldPlan();
+                created->type_name = type_name;
+                this->expanding.insert(fragment->name);
+                this->collect(created, fragment->selection_set, {});
+                this->expanding.erase(fragment->name);
+                this->plans.emplace(key, created);
+                return created;
+            }
+        public:
+            DocumentNode *document;
+            const PossibleTypes *possible_types;
+
+            FieldPlanner(DocumentNode *document, const PossibleTypes *possible_types) {
+                this->document = document;
+                this->possible_types = possible_types;
+            }
+
+            FieldPlanner(const FieldPlanner &) = delete;
+            FieldPlanner &operator=(const FieldPlanner &) = delete;
+
+            ~FieldPlanner() {
+                for (auto &plan : this->plans)
+                    delete plan.second;
+            }
+
+            // Plan for a root selection set, such as an operation's.
+            const FieldPlan *plan(SelectionSetNode *selection_set, const std::string &type_name) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                auto key = std::make_pair(static_cast<const void *>(selection_set), type_name);
+                auto plan = this->plans.find(key);
+                if (plan != this->plans.end())
+                    return plan->second;
+                FieldPlan *created = new FieldPlan();
+                created->type_name = type_name;
+                this->collect(created, selection_set, {});
+                this->plans.emplace(key, created);
+                return created;
+            }
+
+            // Plan for the merged sub-selections of a field from another plan of this planner. The
+            // field's conditions carry over to its sub-fields.
+            const FieldPlan *plan(const CollectedField *field, const std::string &type_name) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                auto key = std::make_pair(static_cast<const void *>(field), type_name);
+                auto plan = this->plans.find(key);
+                if (plan != this->plans.end())
+                    return plan->second;
+                FieldPlan *created = new FieldPlan();
+                created->type_name = type_name;
+                for (auto &node : field->nodes)
+                    if (node.node->selection_set != nullptr)
+                        this->collect(created, node.node->selection_set, node.conditions);
+                this->plans.emplace(key, created);
+                return created;
+            }
+    };
+
+    void DocumentNode::clear_plans() {
+        std::lock_guard<std::mutex> lock(this->plans_mutex);
+        for (auto &plan : this->argument_plans)
+            delete plan.second;
+        this->argument_plans.clear();
+        for (auto &planner : this->field_planners)
+            delete planner.second;
+        this->field_planners.clear();
+    }
+
+    DocumentNode::~DocumentNode() {
+        this->clear_plans();
+        for (auto node : this->nodes)
+            delete node;
+    }
+
+    ArgumentPlan *DocumentNode::argument_plan(std::string operation_name) {
+        std::lock_guard<std::mutex> lock(this->plans_mutex);
+        auto plan = this->argument_plans.find(operation_name);
+        if (plan != this->argument_plans.end())
+            return plan->second;
+        ArgumentPlan *created = new ArgumentPlan(this, this->get_operation(operation_name));
+        this->argument_plans.emplace(operation_name, created);
+        return created;
+    }
+
+    FieldPlanner *DocumentNode::field_planner(const PossibleTypes &possible_types) {
+        std::lock_guard<std::mutex> lock(this->plans_mutex);
+        auto planner = this->field_planners.find(&possible_types);
+        if (planner != this->field_planners.end())
+            return planner->second;
+        FieldPlanner *created = new FieldPlanner(this, &possible_types);
+        this->field_planners.emplace(&possible_types, created);
+        return created;
+    }
+
+    // Schema snapshots hold the tables of a schema built from SDL in one flat buffer, so workers can
+    // map a compiled file and use it in place instead of lexing and building the SDL on every start.
+    // All integers are uint32_t in the byte order of the machine that wrote the snapshot, and every
+    // reference is an offset from the start of the snapshot or an index into one of its tables, so
+    // a snapshot can be mapped at any address and shared read-only between processes. Types and
+    // directives are sorted by name; fields, arguments and values keep their SDL order.
+    const char SCHEMA_SNAPSHOT_MAGIC[8] = {'G', 'Q', 'L', 'S', 'N', 'A', 'P', '\0'};
+    const uint32_t SCHEMA_SNAPSHOT_VERSION = 2;
+    const uint32_t SCHEMA_SNAPSHOT_BYTE_ORDER = 0x01020304;
+    // Marks absent strings, types and root operation types.
+    const uint32_t SNAPSHOT_NONE = 0xFFFFFFFF;
+
+    enum SchemaTypeKind {
+        SCALAR_TYPE,
+        OBJECT_TYPE,
+        INTERFACE_TYPE,
+        UNION_TYPE,
+        ENUM_TYPE,
+        INPUT_OBJECT_TYPE
+    };
+
+    class SnapshotTable {
+        public:
+            uint32_t offset;
+            uint32_t count;
+    };
+
+    class SnapshotString {
+        public:
+            uint32_t offset;
+            uint32_t length;
+    };
+
+    class SnapshotType {
+        public:
+            uint32_t kind;
+            uint32_t name;
+            uint32_t description;
+            // Fields of object and interface types, input values of input object types and enum
+            // values of enum types
+            uint32_t first_field;
+            uint32_t field_count;
+            // Member table ranges
+            uint32_t first_interface;
+            uint32_t interface_count;
+            uint32_t first_possible_type;
+            uint32_t possible_type_count;
+            // @specifiedBy URL of scalar types
+            uint32_t specified_by_url;
+    };
+
+    class SnapshotField {
+        public:
+            uint32_t name;
+            uint32_t description;
+            uint32_t type;
+            uint32_t first_argument;
+            uint32_t argument_count;
+            uint32_t deprecation_reason;
+    };
+
+    // Arguments and input object fields. Default values are printed GraphQL literals.
+    class SnapshotInputValue {
+        public:
+            uint32_t name;
+            uint32_t description;
+            uint32_t type;
+            uint32_t default_value;
+            uint32_t deprecation_reason;
+    };
+
+    class SnapshotEnumValue {
+        public:
+            uint32_t name;
+            uint32_t description;
+            uint32_t deprecation_reason;
+    };
+
+    // A TypeKind with a type index for named types, or the index of the wrapped type reference,
+    // which always comes earlier in the table.
+    class SnapshotTypeRef {
+        public:
+            uint32_t kind;
+            uint32_t target;
+    };
+
+    class SnapshotDirective {
+        public:
+            uint32_t name;
+            uint32_t description;
+            uint32_t first_argument;
+            uint32_t argument_count;
+            // One bit per entry of directive_locations
+            uint32_t locations;
+            uint32_t repeatable;
+    };
+
+    class SnapshotHeader {
+        public:
+            char magic[8];
+            uint32_t byte_order;
+            uint32_t version;
+            uint32_t size;
+            uint32_t query_type;
+            uint32_t mutation_type;
+            uint32_t subscription_type;
+            SnapshotTable strings;
+            SnapshotTable types;
+            SnapshotTable fields;
+            SnapshotTable input_values;
+            SnapshotTable enum_values;
+            SnapshotTable type_refs;
+            SnapshotTable members;
+            SnapshotTable directives;
+    };
+
+    // Read-only view of a schema snapshot. Loading only checks that every table and index is in
+    // bounds; lookups then read the snapshot in place. Copies share the same storage.
+    class Schema {
+        private:
+            std::shared_ptr<const char> storage;
+            size_t length;
+            const SnapshotHeader *header;
+
+            template <class T>
+            const T *table(const SnapshotTable &table) const {
+                return reinterpret_cast<const T *>(this->storage.get() + table.offset);
+            }
+
+            void validate() const;
+        public:
+            Schema(std::shared_ptr<const char> storage, size_t length) : storage(storage), length(length) {
+                this->header = reinterpret_cast<const SnapshotHeader *>(this->storage.get());
+                this->validate();
+            }
+
+            static Schema from_bytes(std::string bytes) {
+                auto buffer = std::make_shared<const std::string>(std::move(bytes));
+                return Schema(std::shared_ptr<const char>(buffer, buffer->data()), buffer->length());
+            }
+
+            // Maps a snapshot file. The mapping is shared with every other process mapping it.
+            static Schema load(const std::string &path);
+
+            const char *data() const {
+                return this->storage.get();
+            }
+
+            size_t size() const {
+                return this->length;
+            }
+
+            std::string_view string(uint32_t index) const {
+                if (index == SNAPSHOT_NONE)
+                    return std::string_view();
+                const SnapshotString &string = this->table<SnapshotString>(this->header->strings)[index];
+                return std::string_view(this->storage.get() + string.offset, string.length);
+            }
+
+            uint32_t type_count() const {
+                return this->header->types.count;
+            }
+
+            const SnapshotType &type(uint32_t index) const {
+                return this->table<SnapshotType>(this->header->types)[index];
+            }
+
+            // Index of the named type, or SNAPSHOT_NONE.
+            uint32_t find_type(std::string_view name) const {
+                const SnapshotType *types = this->table<SnapshotType>(this->header->types);
+                const SnapshotType *type = std::lower_bound(types, types + this->type_count(), name, [this](const SnapshotType &type, std::string_view name) {
+                    return this->string(type.name) < name;
+                });
+                if (type == types + this->type_count() || this->string(type->name) != name)
+                    return SNAPSHOT_NONE;
+                return type - types;
+            }
+
+            const SnapshotField &field(uint32_t index) const {
+                return this->table<SnapshotField>(this->header->fields)[index];
+            }
+
+            // Index of the named field of an object or interface type, or SNAPSHOT_NONE.
+            uint32_t find_field(uint32_t type_index, std::string_view name) const {
+                const SnapshotType &type = this->type(type_index);
+                if (type.kind != OBJECT_TYPE && type.kind != INTERFACE_TYPE)
+                    return SNAPSHOT_NONE;
+                for (uint32_t index = type.first_field; index < type.first_field + type.field_count; index++)
+                    if (this->string(this->field(index).name) == name)
+                        return index;
+                return SNAPSHOT_NONE;
+            }
+
+            const SnapshotInputValue &input_value(uint32_t index) const {
+                return this->table<SnapshotInputValue>(this->header->input_values)[index];
+            }
+
+            const SnapshotEnumValue &enum_value(uint32_t index) const {
+                return this->table<SnapshotEnumValue>(this->header->enum_values)[index];
+            }
+
+            const SnapshotTypeRef &type_ref(uint32_t index) const {
+                return this->table<SnapshotTypeRef>(this->header->type_refs)[index];
+            }
+
+            // Type index stored in the member table.
+            uint32_t member(uint32_t index) const {
+                return this->table<uint32_t>(this->header->members)[index];
+            }
+
+            uint32_t directive_count() const {
+                return this->header->directives.count;
+            }
+
+            const SnapshotDirective &directive(uint32_t index) const {
+                return this->table<SnapshotDirective>(this->header->directives)[index];
+            }
+
+            uint32_t find_directive(std::string_view name) const {
+                const SnapshotDirective *directives = this->table<SnapshotDirective>(this->header->directives);
+                const SnapshotDirective *directive = std::lower_bound(directives, directives + this->directive_count(), name, [this](const SnapshotDirective &directive, std::string_view name) {
+                    return this->string(directive.name) < name;
+                });
+                if (directive == directives + this->directive_count() || this->string(directive->name) != name)
+                    return SNAPSHOT_NONE;
+                return directive - directives;
+            }
+
+            uint32_t query_type() const {
+                return this->header->query_type;
+            }
+
+            uint32_t mutation_type() const {
+                return this->header->mutation_type;
+            }
+
+            uint32_t subscription_type() const {
+                return this->header->subscription_type;
+            }
+
+            std::string print_type_ref(uint32_t index) const {
+                const SnapshotTypeRef &type = this->type_ref(index);
+                if (type.kind == LIST_TYPE)
+                    return fmt::format("[{}]", this->print_type_ref(type.target));
+                if (type.kind == NON_NULL_TYPE)
+                    return this->print_type_ref(type.target) + "!";
+                return std::string(this->string(this->type(type.target).name));
+            }
+
+            // Concrete types of every interface and union, for FieldPlanner.
+            PossibleTypes possible_types() const {
+                PossibleTypes possible_types;
+                for (uint32_t index = 0; index < this->type_count(); index++) {
+                    const SnapshotType &type = this->type(index);
+                    if (type.kind != INTERFACE_TYPE && type.kind != UNION_TYPE)
+                        continue;
+                    auto &names = possible_types[std::string(this->string(type.name))];
+                    for (uint32_t member = type.first_possible_type; member < type.first_possible_type + type.possible_type_count; member++)
+                        names.emplace(this->string(this->type(this->member(member)).name));
+                }
+                return possible_types;
+            }
+    };
+
+    void Schema::validate() const {
+        auto check = [](bool condition, const char *problem) {
+            if (!condition)
+                throw GraphQLError(fmt::format("Invalid schema snapshot: {}.", problem));
+        };
+        check(this->length >= sizeof(SnapshotHeader) && this->length <= UINT32_MAX, "unexpected size");
+        check(std::memcmp(this->header->magic, SCHEMA_SNAPSHOT_MAGIC, sizeof(SCHEMA_SNAPSHOT_MAGIC)) == 0, "bad magic number");
+        check(this->header->byte_order == SCHEMA_SNAPSHOT_BYTE_ORDER, "written with a different byte order");
+        if (this->header->version != SCHEMA_SNAPSHOT_VERSION)
+            throw GraphQLError(fmt::format("Invalid schema snapshot: version {} is not supported, expected {}.", this->header->version, SCHEMA_SNAPSHOT_VERSION));
+        check(this->header->size == this->length, "truncated");
+
+        auto check_table = [&](const SnapshotTable &table, size_t record_size) {
+            check(table.offset % alignof(uint32_t) == 0 && table.offset + static_cast<uint64_t>(table.count) * record_size <= this->length, "table out of bounds");
+        };
+        check_table(this->header->strings, sizeof(SnapshotString));
+        check_table(this->header->types, sizeof(SnapshotType));
+        check_table(this->header->fields, sizeof(SnapshotField));
+        check_table(this->header->input_values, sizeof(SnapshotInputValue));
+        check_table(this->header->enum_values, sizeof(SnapshotEnumValue));
+        check_table(this->header->type_refs, sizeof(SnapshotTypeRef));
+        check_table(this->header->members, sizeof(uint32_t));
+        check_table(this->header->directives, sizeof(SnapshotDirective));
+
+        for (uint32_t index = 0; index < this->header->strings.count; index++) {
+            const SnapshotString &string = this->table<SnapshotString>(this->header->strings)[index];
+            check(static_cast<uint64_t>(string.offset) + string.length <= this->length, "string out of bounds");
+        }
+        auto check_string = [&](uint32_t index, bool optional) {
+            check(index < this->header->strings.count || (optional && index == SNAPSHOT_NONE), "bad string index");
+        };
+        auto check_range = [&](uint32_t first, uint32_t count, const SnapshotTable &table) {
+            check(static_cast<uint64_t>(first) + count <= table.count, "bad table range");
+        };
+        auto check_index = [&](uint32_t index, uint32_t count, bool optional) {
+            check(index < count || (optional && index == SNAPSHOT_NONE), "bad index");
+        };
+        uint32_t type_count = this->header->types.count;
+        for (uint32_t index = 0; index < type_count; index++) {
+            const SnapshotType &type = this->type(index);
+            check_string(type.name, false);
+            check_string(type.description, true);
+            check_string(type.specified_by_url, true);
+            switch (type.kind) {
+                case OBJECT_TYPE:
+                case INTERFACE_TYPE:
+                    check_range(type.first_field, type.field_count, this->header->fields);
+                    break;
+                case ENUM_TYPE:
+                    check_range(type.first_field, type.field_count, this->header->enum_values);
+                    break;
+                case INPUT_OBJECT_TYPE:
+                    check_range(type.first_field, type.field_count, this->header->input_values);
+                    break;
+                case SCALAR_TYPE:
+                case UNION_TYPE:
+                    check(type.field_count == 0, "bad table range");
+                    break;
+                default:
+                    check(false, "bad type kind");
+            }
+            check_range(type.first_interface, type.interface_count, this->header->members);
+            check_range(type.first_possible_type, type.possible_type_count, this->header->members);
+        }
+        for (uint32_t index = 0; index < this->header->fields.count; index++) {
+            const SnapshotField &field = this->field(index);
+            check_string(field.name, false);
+            check_string(field.description, true);
+            check_string(field.deprecation_reason, true);
+            check_index(field.type, this->header->type_refs.count, false);
+            check_range(field.first_argument, field.argument_count, this->header->input_values);
+        }
+        for (uint32_t index = 0; index < this->header->input_values.count; index++) {
+            const SnapshotInputValue &value = this->input_value(index);
+            check_string(value.name, false);
+            check_string(value.description, true);
+            check_string(value.default_value, true);
+            check_string(value.deprecation_reason, true);
+            check_index(value.type, this->header->type_refs.count, false);
+        }
+        for (uint32_t index = 0; index < this->header->enum_values.count; index++) {
+            const SnapshotEnumValue &value = this->enum_value(index);
+            check_string(value.name, false);
+            check_string(value.description, true);
+            check_string(value.deprecation_reason, true);
+        }
+        for (uint32_t index = 0; index < this->header->type_refs.count; index++) {
+            const SnapshotTypeRef &type = this->type_ref(index);
+            if (type.kind == NAMED_TYPE)
+                check_index(type.target, type_count, false);
+            else
+                check((type.kind == LIST_TYPE || type.kind == NON_NULL_TYPE) && type.target < index, "bad type reference");
+        }
+        for (uint32_t index = 0; index < this->header->members.count; index++)
+            check_index(this->member(index), type_count, false);
+        for (uint32_t index = 0; index < this->header->directives.count; index++) {
+            const SnapshotDirective &directive = this->directive(index);
+            check_string(directive.name, false);
+            check_string(directive.description, true);
+            check_range(directive.first_argument, directive.argument_count, this->header->input_values);
+        }
+        check_index(this->header->query_type, type_count, true);
+        check_index(this->header->mutation_type, type_count, true);
+        check_index(this->header->subscription_type, type_count, true);
+    }
+
+    Schema Schema::load(const std::string &path) {
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            throw GraphQLError(fmt::format("Cannot open schema snapshot \"{}\": {}.", path, std::strerror(errno)));
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+            close(file);
+            throw GraphQLError("Invalid schema snapshot: unexpected size.");
+        }
+        size_t length = status.st_size;
+        void *mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+        close(file);
+        if (mapping == MAP_FAILED)
+            throw GraphQLError(fmt::format("Cannot map schema snapshot \"{}\": {}.", path, std::strerror(errno)));
+        std::shared_ptr<const char> storage(static_cast<const char *>(mapping), [length](const char *data) {
+            munmap(const_cast<char *>(data), length);
+        });
+        return Schema(storage, length);
+    }
+
+    // Added to every schema that does not define them itself.
+    const char *builtin_schema = R"SDL(
+"The `Int` scalar type represents non-fractional signed whole numeric values. Int can represent values between -(2^31) and 2^31 - 1."
+scalar Int
+
+"The `Float` scalar type represents signed double-precision fractional values as specified by [IEEE 754](https://en.wikipedia.org/wiki/IEEE_floating_point)."
+scalar Float
+
+"The `String` scalar type represents textual data, represented as UTF-8 character sequences. The String type is most often used by GraphQL to represent free-form human-readable text."
+scalar String
+
+"The `Boolean` scalar type represents `true` or `false`."
+scalar Boolean
+
+"The `ID` scalar type represents a unique identifier, often used to refetch an object or as key for a cache. The ID type appears in a JSON response as a String; however, it is not intended to be human-readable. When expected as an input type, any string (such as `\"4\"`) or integer (such as `4`) input value will be accepted as an ID."
+scalar ID
+
+"Directs the executor to include this field or fragment only when the `if` argument is true."
+directive @include("Included when true." if: Boolean!) on FIELD | FRAGMENT_SPREAD | INLINE_FRAGMENT
+
+"Directs the executor to skip this field or fragment when the `if` argument is true."
+directive @skip("Skipped when true." if: Boolean!) on FIELD | FRAGMENT_SPREAD | INLINE_FRAGMENT
+
+"Marks an element of a GraphQL schema as no longer supported."
+directive @deprecated("Explains why this element was deprecated, usually also including a suggestion for how to access supported similar data. Formatted using the Markdown syntax, as specified by [CommonMark](https://commonmark.org/)." reason: String = "No longer supported") on FIELD_DEFINITION | ARGUMENT_DEFINITION | INPUT_FIELD_DEFINITION | ENUM_VALUE
+
+"Exposes a URL that specifies the behaviour of this scalar."
+directive @specifiedBy("The URL that specifies the behaviour of this scalar." url: String!) on SCALAR
+)SDL";
+
+    // Builds the schema tables from SDL documents and lays them out as a snapshot. Extensions are
+    // merged into the types they extend.
+    class SchemaSnapshotWriter {
+        private:
+            std::map<std::string, std::vector<TypeDefinitionNode *>> type_definitions;
+            std::map<std::string, DirectiveDefinitionNode *> directive_definitions;
+            std::vector<SchemaDefinitionNode *> schema_definitions;
+            std::map<std::string, uint32_t> type_indexes;
+            std::map<std::string, uint32_t> string_indexes;
+            std::vector<const std::string *> strings;
+            std::vector<SnapshotType> types;
+            std::vector<SnapshotField> fields;
+            std::vector<SnapshotInputValue> input_values;
+            std::vector<SnapshotEnumValue> enum_values;
+            std::vector<SnapshotTypeRef> type_refs;
+            std::vector<uint32_t> members;
+            std::vector<SnapshotDirective> directives;
+
+            void add_definitions(DocumentNode *document, bool builtin) {
+                for (auto definition : document->definitions) {
+                    if (definition->kind == SCHEMA_DEFINITION) {
+                        SchemaDefinitionNode *schema = static_cast<SchemaDefinitionNode *>(definition);
+                        if (!schema->extension && std::any_of(this->schema_definitions.begin(), this->schema_definitions.end(),
+                                    [](SchemaDefinitionNode *existing) { return !existing->extension; }))
+                            throw GraphQLError("Must provide only one schema definition.");
+                        this->schema_definitions.push_back(schema);
+                    } else if (definition->kind == DIRECTIVE_DEFINITION) {
+                        DirectiveDefinitionNode *directive = static_cast<DirectiveDefinitionNode *>(definition);
+                        if (this->directive_definitions.count(directive->name) > 0) {
+                            if (builtin)
+                                continue;
+                            throw GraphQLError(fmt::format("There can be only one directive named \"@{}\".", directive->name));
+                        }
+                        this->directive_definitions.emplace(directive->name, directive);
+                    } else if (definition->kind != OPERATION_DEFINITION && definition->kind != FRAGMENT_DEFINITION) {
+                        TypeDefinitionNode *type = static_cast<TypeDefinitionNode *>(definition);
+                        std::vector<TypeDefinitionNode *> &definitions = this->type_definitions[type->name];
+                        if (type->extension) {
+                            definitions.push_back(type);
+                        } else if (!definitions.empty() && !definitions.front()->extension) {
+                            if (builtin)
+                                continue;
+                            throw GraphQLError(fmt::format("There can be only one type named \"{}\".", type->name));
+                        } else {
+                            definitions.insert(definitions.begin(), type);
+                        }
+                    }
+                }
+            }
+
+            // Empty strings are absent unless kept, as deprecation reasons are.
+            uint32_t string(const std::string &value, bool keep_empty = false) {
+                if (value.empty() && !keep_empty)
+                    return SNAPSHOT_NONE;
+                auto index = this->string_indexes.emplace(value, this->strings.size());
+                if (index.second)
+                    this->strings.push_back(&index.first->first);
+                return index.first->second;
+            }
+
+            uint32_t named_type(const std::string &name) {
+                auto index = this->type_indexes.find(name);
+                if (index == this->type_indexes.end())
+                    throw GraphQLError(fmt::format("Unknown type \"{}\".", name));
+                return index->second;
+            }
+
+            uint32_t type_ref(TypeNode *type) {
+                SnapshotTypeRef record;
+                record.kind = type->kind;
+                record.target = type->kind == NAMED_TYPE ? this->named_type(type->name) : this->type_ref(type->type);
+                this->type_refs.push_back(record);
+                return this->type_refs.size() - 1;
+            }
+
+            // Definition kind of the named type a type reference wraps, once the type is known.
+            DefinitionKind named_kind(TypeNode *type) {
+                while (type->kind != NAMED_TYPE)
+                    type = type->type;
+                return this->type_definitions[type->name].front()->kind;
+            }
+
+            uint32_t deprecation_reason(const std::vector<DirectiveNode *> &directives) {
+                for (auto directive : directives) {
+                    if (directive->name != "deprecated")
+                        continue;
+                    for (auto argument : directive->arguments)
+                        if (argument->name == "reason" && argument->value->kind == STRING_VALUE)
+                            return this->string(argument->value->value, true);
+                    return this->string("No longer supported");
+                }
+                return SNAPSHOT_NONE;
+            }
+
+            uint32_t specified_by_url(const std::vector<TypeDefinitionNode *> &definitions) {
+                for (auto definition : definitions)
+                    for (auto directive : definition->directives)
+                        if (directive->name == "specifiedBy")
+                            for (auto argument : directive->arguments)
+                                if (argument->name == "url" && argument->value->kind == STRING_VALUE)
+                                    return this->string(argument->value->value, true);
+                return SNAPSHOT_NONE;
+            }
+
+            // Arguments are named "<owner>(<name>:)" and input fields "<owner>.<name>" in errors.
+            void add_input_values(const std::vector<InputValueDefinitionNode *> &definitions, const std::string &owner, bool arguments) {
+                for (auto definition : definitions) {
+                    SnapshotInputValue value;
+                    value.name = this->string(definition->name);
+                    value.description = this->string(definition->description);
+                    value.type = this->type_ref(definition->type);
+                    DefinitionKind kind = this->named_kind(definition->type);
+                    if (kind != SCALAR_TYPE_DEFINITION && kind != ENUM_TYPE_DEFINITION && kind != INPUT_OBJECT_TYPE_DEFINITION)
+                        throw GraphQLError(fmt::format("The type of {} must be Input Type but got: {}.",
+                                    arguments ? fmt::format("{}({}:)", owner, definition->name) : fmt::format("{}.{}", owner, definition->name), print_type(definition->type)));
+                    value.default_value = definition->default_value != nullptr ? this->string(print_value_node(definition->default_value)) : SNAPSHOT_NONE;
+                    value.deprecation_reason = this->deprecation_reason(definition->directives);
+                    this->input_values.push_back(value);
+                }
+            }
+
+            void add_type(const std::string &name, const std::vector<TypeDefinitionNode *> &definitions,
+                    const std::map<std::string, std::vector<uint32_t>> &implementations) {
+                TypeDefinitionNode *definition = definitions.front();
+                if (definition->extension)
+                    throw GraphQLError(fmt::format("Cannot extend type \"{}\" because it is not defined.", name));
+                SnapshotType type = { };
+                type.kind = definition->kind - SCALAR_TYPE_DEFINITION;
+                type.name = this->string(name);
+                type.description = this->string(definition->description);
+                type.specified_by_url = definition->kind == SCALAR_TYPE_DEFINITION ? this->specified_by_url(definitions) : SNAPSHOT_NONE;
+                auto table_size = [&]() {
+                    if (definition->kind == ENUM_TYPE_DEFINITION)
+                        return this->enum_values.size();
+                    if (definition->kind == INPUT_OBJECT_TYPE_DEFINITION)
+                        return this->input_values.size();
+                    return this->fields.size();
+                };
+                type.first_field = table_size();
+                // Arguments are added while fields are collected, so fields are appended afterwards.
+                std::vector<SnapshotField> fields;
+                std::unordered_set<std::string> names;
+                auto unique = [&](const std::string &member, const char *what) {
+                    if (!names.insert(member).second)
+                        throw GraphQLError(fmt::format("{} \"{}.{}\" can only be defined once.", what, name, member));
+                };
+                for (auto extension : definitions) {
+                    if (extension->kind != definition->kind) {
+                        const char *kinds[] = {"scalar", "object", "interface", "union", "enum", "input object"};
+                        throw GraphQLError(fmt::format("Cannot extend non-{} type \"{}\".", kinds[type.kind], name));
+                    }
+                    for (auto field : extension->fields) {
+                        unique(field->name, "Field");
+                        SnapshotField record;
+                        record.name = this->string(field->name);
+                        record.description = this->string(field->description);
+                        record.first_argument = this->input_values.size();
+                        record.argument_count = field->arguments.size();
+                        this->add_input_values(field->arguments, fmt::format("{}.{}", name, field->name), true);
+                        record.type = this->type_ref(field->type);
+                        if (this->named_kind(field->type) == INPUT_OBJECT_TYPE_DEFINITION)
+                            throw GraphQLError(fmt::format("The type of {}.{} must be Output Type but got: {}.", name, field->name, print_type(field->type)));
+                        record.deprecation_reason = this->deprecation_reason(field->directives);
+                        fields.push_back(record);
+                    }
+                    for (auto value : extension->values) {
+                        unique(value->name, "Enum value");
+                        SnapshotEnumValue record;
+                        record.name = this->string(value->name);
+                        record.description = this->string(value->description);
+                        record.deprecation_reason = this->deprecation_reason(value->directives);
+                        this->enum_values.push_back(record);
+                    }
+                    for (auto field : extension->input_fields)
+                        unique(field->name, "Field");
+                    this->add_input_values(extension->input_fields, name, false);
+                }
+                this->fields.insert(this->fields.end(), fields.begin(), fields.end());
+                type.field_count = table_size() - type.first_field;
+
+                type.first_interface = this->members.size();
+                for (auto extension : definitions)
+                    for (auto &interface : extension->interfaces)
+                        this->members.push_back(this->named_type(interface));
+                type.interface_count = this->members.size() - type.first_interface;
+
+                type.first_possible_type = this->members.size();
+                if (definition->kind == UNION_TYPE_DEFINITION) {
+                    for (auto extension : definitions)
+                        for (auto &member : extension->types)
+                            this->members.push_back(this->named_type(member));
+                } else if (definition->kind == INTERFACE_TYPE_DEFINITION) {
+                    auto implementation = implementations.find(name);
+                    if (implementation != implementations.end())
+                        this->members.insert(this->members.end(), implementation->second.begin(), implementation->second.end());
+                }
+                type.possible_type_count = this->members.size() - type.first_possible_type;
+                this->types.push_back(type);
+            }
+
+            template <class T>
+            void place(SnapshotTable &table, const std::vector<T> &records, size_t &offset) {
+                table.offset = offset;
+                table.count = records.size();
+                offset += records.size() * sizeof(T);
+            }
+
+            template <class T>
+            void copy(std::string &bytes, const SnapshotTable &table, const std::vector<T> &records) {
+                if (!records.empty())
+                    std::memcpy(&bytes[table.offset], records.data(), records.size() * sizeof(T));
+            }
+        public:
+            // Builds the schema defined by the SDL source and returns its snapshot. Throws
+            // GraphQLError for syntax errors and for definitions that do not form a schema.
+            std::string write(Source *source) {
+                std::unique_ptr<DocumentNode> document(parse(source));
+                static Source builtin_source(builtin_schema, "Built-in schema");
+                std::unique_ptr<DocumentNode> builtins(parse(&builtin_source));
+                this->add_definitions(document.get(), false);
+                this->add_definitions(builtins.get(), true);
+
+                for (auto &definitions : this->type_definitions)
+                    this->type_indexes.emplace(definitions.first, this->type_indexes.size());
+                std::map<std::string, std::vector<uint32_t>> implementations;
+                for (auto &definitions : this->type_definitions)
+                    for (auto definition : definitions.second)
+                        if (definition->kind == OBJECT_TYPE_DEFINITION)
+                            for (auto &interface : definition->interfaces)
+                                implementations[interface].push_back(this->type_indexes[definitions.first]);
+                for (auto &definitions : this->type_definitions)
+                    this->add_type(definitions.first, definitions.second, implementations);
+
+                for (auto &definition : this->directive_definitions) {
+                    DirectiveDefinitionNode *directive = definition.second;
+                    SnapshotDirective record = { };
+                    record.name = this->string(directive->name);
+                    record.description = this->string(directive->description);
+                    record.first_argument = this->input_values.size();
+                    record.argument_count = directive->arguments.size();
+                    this->add_input_values(directive->arguments, "@" + directive->name, true);
+                    for (auto &location : directive->locations)
+                        record.locations |= 1u << (std::find(directive_locations.begin(), directive_locations.end(), location) - directive_locations.begin());
+                    record.repeatable = directive->repeatable;
+                    this->directives.push_back(record);
+                }
+
+                SnapshotHeader header = { };
+                std::memcpy(header.magic, SCHEMA_SNAPSHOT_MAGIC, sizeof(SCHEMA_SNAPSHOT_MAGIC));
+                header.byte_order = SCHEMA_SNAPSHOT_BYTE_ORDER;
+                header.version = SCHEMA_SNAPSHOT_VERSION;
+                // Without a schema definition, root types are found by their conventional names.
+                std::string roots[] = {"Query", "Mutation", "Subscription"};
+                uint32_t *root_types[] = {&header.query_type, &header.mutation_type, &header.subscription_type};
+                for (int operation = QUERY; operation <= SUBSCRIPTION; operation++)
+                    *root_types[operation] = this->schema_definitions.empty() && this->type_indexes.count(roots[operation]) > 0
+                            ? this->type_indexes[roots[operation]] : SNAPSHOT_NONE;
+                for (auto schema : this->schema_definitions)
+                    for (auto &operation_type : schema->operation_types)
+                        *root_types[operation_type.first] = this->named_type(operation_type.second);
+
+                std::vector<SnapshotString> strings(this->strings.size());
+                size_t offset = sizeof(SnapshotHeader);
+                this->place(header.strings, strings, offset);
+                this->place(header.types, this->types, offset);
+                this->place(header.fields, this->fields, offset);
+                this->place(header.input_values, this->input_values, offset);
+                this->place(header.enum_values, this->enum_values, offset);
+                this->place(header.type_refs, this->type_refs, offset);
+                this->place(header.members, this->members, offset);
+                this->place(header.directives, this->directives, offset);
+                for (size_t index = 0; index < this->strings.size(); index++) {
+                    strings[index].offset = offset;
+                    strings[index].length = this->strings[index]->length();
+                    offset += this->strings[index]->length();
+                }
+                if (offset > UINT32_MAX)
+                    throw GraphQLError("Schema is too large for a snapshot.");
+                header.size = offset;
+
+                std::string bytes(offset, '\0');
+                std::memcpy(&bytes[0], &header, sizeof(header));
+                this->copy(bytes, header.strings, strings);
+                this->copy(bytes, header.types, this->types);
+                this->copy(bytes, header.fields, this->fields);
+                this->copy(bytes, header.input_values, this->input_values);
+                this->copy(bytes, header.enum_values, this->enum_values);
+                this->copy(bytes, header.type_refs, this->type_refs);
+                this->copy(bytes, header.members, this->members);
+                this->copy(bytes, header.directives, this->directives);
+                for (size_t index = 0; index < this->strings.size(); index++)
+                    std::memcpy(&bytes[strings[index].offset], this->strings[index]->data(), strings[index].length);
+                return bytes;
+            }
+    };
+
+    std::string compile_schema(Source *source) {
+        SchemaSnapshotWriter writer;
+        return writer.write(source);
+    }
+
+    // Prints a snapshot back as SDL, without the built-in scalars and directives. Compiling the
+    // printed SDL gives the same snapshot.
+    std::string print_schema(const Schema &schema) {
+        std::unordered_set<std::string_view> builtins {"Int", "Float", "String", "Boolean", "ID", "include", "skip", "deprecated", "specifiedBy"};
+        std::vector<std::string> definitions;
+        auto description = [&](uint32_t index, const std::string &indent) {
+            return index == SNAPSHOT_NONE ? "" : fmt::format("{}\"{}\"\n", indent, escape_string(std::string(schema.string(index))));
+        };
+        auto deprecated = [&](uint32_t reason) {
+            if (reason == SNAPSHOT_NONE)
+                return std::string();
+            if (schema.string(reason) == "No longer supported")
+                return std::string(" @deprecated");
+            return fmt::format(" @deprecated(reason: \"{}\")", escape_string(std::string(schema.string(reason))));
+        };
+        auto input_value = [&](uint32_t index) {
+            const SnapshotInputValue &value = schema.input_value(index);
+            std::string printed = fmt::format("{}: {}", schema.string(value.name), schema.print_type_ref(value.type));
+            if (value.description != SNAPSHOT_NONE)
+                printed = fmt::format("\"{}\" {}", escape_string(std::string(schema.string(value.description))), printed);
+            if (value.default_value != SNAPSHOT_NONE)
+                printed += fmt::format(" = {}", schema.string(value.default_value));
+            return printed + deprecated(value.deprecation_reason);
+        };
+        auto arguments = [&](uint32_t first, uint32_t count) {
+            std::vector<std::string> printed;
+            for (uint32_t index = first; index < first + count; index++)
+                printed.push_back(input_value(index));
+            return count == 0 ? std::string() : fmt::format("({})", fmt::join(printed, ", "));
+        };
+
+        const char *operations[] = {"query", "mutation", "subscription"};
+        const char *conventional_names[] = {"Query", "Mutation", "Subscription"};
+        uint32_t root_types[] = {schema.query_type(), schema.mutation_type(), schema.subscription_type()};
+        bool conventional = true;
+        for (int operation = QUERY; operation <= SUBSCRIPTION; operation++)
+            conventional = conventional && schema.find_type(conventional_names[operation]) == root_types[operation];
+        if (!conventional) {
+            std::string printed = "schema {\n";
+            for (int operation = QUERY; operation <= SUBSCRIPTION; operation++)
+                if (root_types[operation] != SNAPSHOT_NONE)
+                    printed += fmt::format("  {}: {}\n", operations[operation], schema.string(schema.type(root_types[operation]).name));
+            definitions.push_back(printed + "}");
+        }
+
+        for (uint32_t index = 0; index < schema.directive_count(); index++) {
+            const SnapshotDirective &directive = schema.directive(index);
+            if (builtins.count(schema.string(directive.name)) > 0)
+                continue;
+            std::vector<std::string> locations;
+            for (size_t location = 0; location < directive_locations.size(); location++)
+                if (directive.locations & (1u << location))
+                    locations.push_back(directive_locations[location]);
+            definitions.push_back(fmt::format("{}directive @{}{}{} on {}", description(directive.description, ""), schema.string(directive.name),
+                    arguments(directive.first_argument, directive.argument_count), directive.repeatable ? " repeatable" : "", fmt::join(locations, " | ")));
+        }
+
+        const char *keywords[] = {"scalar", "type", "interface", "union", "enum", "input"};
+        for (uint32_t index = 0; index < schema.type_count(); index++) {
+            const SnapshotType &type = schema.type(index);
+            if (builtins.count(schema.string(type.name)) > 0)
+                continue;
+            std::string printed = fmt::format("{}{} {}", description(type.description, ""), keywords[type.kind], schema.string(type.name));
+            if (type.specified_by_url != SNAPSHOT_NONE)
+                printed += fmt::format(" @specifiedBy(url: \"{}\")", escape_string(std::string(schema.string(type.specified_by_url))));
+            std::vector<std::string> names;
+            for (uint32_t member = type.first_interface; member < type.first_interface + type.interface_count; member++)
+                names.emplace_back(schema.string(schema.type(schema.member(member)).name));
+            if (!names.empty())
+                printed += fmt::format(" implements {}", fmt::join(names, " & "));
+            names.clear();
+            if (type.kind == UNION_TYPE) {
+                for (uint32_t member = type.first_possible_type; member < type.first_possible_type + type.possible_type_count; member++)
+                    names.emplace_back(schema.string(schema.type(schema.member(member)).name));
+                if (!names.empty())
+                    printed += fmt::format(" = {}", fmt::join(names, " | "));
+            }
+            std::vector<std::string> lines;
+            for (uint32_t field = type.first_field; field < type.first_field + type.field_count; field++) {
+                if (type.kind == ENUM_TYPE) {
+                    const SnapshotEnumValue &value = schema.enum_value(field);
+                    lines.push_back(fmt::format("{}  {}{}", description(value.description, "  "), schema.string(value.name), deprecated(value.deprecation_reason)));
+                } else if (type.kind == INPUT_OBJECT_TYPE) {
+                    lines.push_back("  " + input_value(field));
+                } else {
+                    const SnapshotField &record = schema.field(field);
+                    lines.push_back(fmt::format("{}  {}{}: {}{}", description(record.description, "  "), schema.string(record.name),
+                            arguments(record.first_argument, record.argument_count), schema.print_type_ref(record.type), deprecated(record.deprecation_reason)));
+                }
+            }
+            if (!lines.empty())
+                printed += fmt::format(" {{\n{}\n}}", fmt::join(lines, "\n"));
+            definitions.push_back(printed);
+        }
+        return fmt::format("{}\n", fmt::join(definitions, "\n\n"));
+    }
+
+    // An operation prepared for execution once per signature: the parsed document, an argument
+    // plan with literal slots and the field plan of its root type. Shared by every request with
+    // the same signature, from any thread.
+    class PreparedOperation {
+        public:
+            std::string operation_name;
+            DocumentNode *document;
+            OperationDefinitionNode *operation;
+            ArgumentPlan *arguments;
+            // Kept alive for the field planner
+            std::shared_ptr<const PossibleTypes> possible_types;
+            FieldPlanner *planner;
+            // Null when the schema has no root type for the operation.
+            const FieldPlan *root;
+
+            PreparedOperation(std::shared_ptr<TokenBuffer> tokens, std::string operation_name, std::shared_ptr<const PossibleTypes> possible_types,
+                    const std::string *root_types) {
+                this->operation_name = operation_name;
+                this->possible_types = possible_types;
+                this->document = Parser(tokens).parse_document();
+                this->arguments = nullptr;
+                try {
+                    this->operation = this->document->get_operation(operation_name);
+                    this->arguments = new ArgumentPlan(this->document, this->operation, true);
+                    this->planner = this->document->field_planner(*this->possible_types);
+                    const std::string &root_type = root_types[this->operation->operation];
+                    this->root = root_type.empty() ? nullptr : this->planner->plan(this->operation->selection_set, root_type);
+                } catch (...) {
+                    delete this->arguments;
+                    delete this->document;
+                    throw;
+                }
+            }
+
+            PreparedOperation(const PreparedOperation &) = delete;
+            PreparedOperation &operator=(const PreparedOperation &) = delete;
+
+            ~PreparedOperation() {
+                delete this->arguments;
+                delete this->document;
+            }
+
+            // Literal values of a request with this operation's signature, for resolve().
+            std::vector<Value> literals(const TokenBuffer &tokens) const {
+                return this->arguments->literal_values(tokens);
+            }
+
+            std::vector<ArgumentValues> resolve(const TokenBuffer &tokens, const std::map<std::string, Value> &inputs) const {
+                return this->arguments->resolve(inputs, this->literals(tokens));
+            }
+    };
+
+    class PlanCacheStats {
+        public:
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            // Requests whose signature matched a cached plan of a differently shaped document
+            uint64_t collisions = 0;
+            uint64_t evictions = 0;
+            size_t size = 0;
+
+            double hit_rate() const {
+                uint64_t requests = this->hits + this->misses;
+                return requests == 0 ? 0 : static_cast<double>(this->hits) / requests;
+            }
+    };
+
+    // Least recently used cache of prepared operations keyed by token signature and operation
+    // name. Requests that differ only in literal values, whitespace or comments share one
+    // prepared operation and skip parsing and planning altogether.
+    class PlanCache {
+        private:
+            typedef std::pair<uint64_t, std::string> Key;
+
+            mutable std::mutex mutex;
+            size_t capacity;
+            std::shared_ptr<const PossibleTypes> possible_types;
+            std::string root_types[3];
+            // Most recently used first
+            std::list<std::pair<Key, std::shared_ptr<const PreparedOperation>>> entries;
+            std::map<Key, decltype(entries)::iterator> index;
+            PlanCacheStats counters;
+        public:
+            PlanCache(size_t capacity, PossibleTypes possible_types = PossibleTypes(), std::vector<std::string> root_types = {"Query", "Mutation", "Subscription"}) {
+                this->capacity = std::max<size_t>(capacity, 1);
+                this->possible_types = std::make_shared<const PossibleTypes>(std::move(possible_types));
+                for (int operation = QUERY; operation <= SUBSCRIPTION; operation++)
+                    this->root_types[operation] = (size_t) operation < root_types.size() ? root_types[operation] : "";
+            }
+
+            PlanCache(size_t capacity, const Schema &schema) : PlanCache(capacity, schema.possible_types(), {
+                        std::string(schema.query_type() == SNAPSHOT_NONE ? "" : schema.string(schema.type(schema.query_type()).name)),
+                        std::string(schema.mutation_type() == SNAPSHOT_NONE ? "" : schema.string(schema.type(schema.mutation_type()).name)),
+                        std::string(schema.subscription_type() == SNAPSHOT_NONE ? "" : schema.string(schema.type(schema.subscription_type()).name))}) { }
+
+            PlanCache(const PlanCache &) = delete;
+            PlanCache &operator=(const PlanCache &) = delete;
+
+            // The prepared operation for a request's tokens, built and cached on a miss. Errors
+            // from parsing or planning are thrown and nothing is cached. Resolve arguments with
+            // the request's own tokens.
+            std::shared_ptr<const PreparedOperation> prepare(std::shared_ptr<TokenBuffer> tokens, const std::string &operation_name = "") {
+                Key key(tokens->signature, operation_name);
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    auto entry = this->index.find(key);
+                    if (entry != this->index.end()) {
+                        if (entry->second->second->document->tokens->same_signature(*tokens)) {
+                            this->entries.splice(this->entries.begin(), this->entries, entry->second);
+                            this->counters.hits += 1;
+                            return entry->second->second;
+                        }
+                        this->counters.collisions += 1;
+                    }
+                    this->counters.misses += 1;
+                }
+
+                // Built outside the lock; a racing request for the same key may build it too.
+                auto prepared = std::make_shared<const PreparedOperation>(tokens, operation_name, this->possible_types, this->root_types);
+                std::lock_guard<std::mutex> lock(this->mutex);
+                auto entry = this->index.find(key);
+                if (entry != this->index.end())
+                    this->entries.erase(entry->second);
+                this->entries.emplace_front(key, prepared);
+                this->index[key] = this->entries.begin();
+                while (this->entries.size() > this->capacity) {
+                    this->index.erase(this->entries.back().first);
+                    this->entries.pop_back();
+                    this->counters.evictions += 1;
+                }
+                return prepared;
+            }
+
+            PlanCacheStats stats() const {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                PlanCacheStats stats = this->counters;
+                stats.size = this->entries.size();
+                return stats;
+            }
+
+            void clear() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->entries.clear();
+                this->index.clear();
+            }
+    };
+}
@@ -0,0 +1,85 @@
+#include "graphql-cpp.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <fmt/core.h>
+
+using namespace graphql;
+
+// Compiles schema SDL into a snapshot that workers map with Schema::load, and inspects snapshots.
+//
+//   g++ -std=c++17 -O2 -I. schema_snapshot.cpp -lfmt -o schema_snapshot
+//   ./schema_snapshot compile schema.graphql schema.snapshot
+//   ./schema_snapshot load schema.snapshot
+//   ./schema_snapshot print schema.snapshot
+//
+// The snapshot is written to a temporary file and renamed into place, so workers mapping the old
+// snapshot keep a complete file.
+
+double milliseconds_since(std::chrono::steady_clock::time_point started) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+}
+
+int compile(const std::string &input, const std::string &output) {
+    std::ifstream file(input, std::ios::binary);
+    if (!file) {
+        std::cerr << fmt::format("Cannot read \"{}\"", input) << std::endl;
+        return 1;
+    }
+    std::string sdl((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto started = std::chrono::steady_clock::now();
+    std::string bytes = compile_schema(new Source(sdl, input));
+    double elapsed = milliseconds_since(started);
+
+    std::string temporary = output + ".tmp";
+    std::ofstream snapshot(temporary, std::ios::binary);
+    snapshot << bytes;
+    snapshot.close();
+    // A short write must not replace the snapshot workers are mapping
+    if (!snapshot.good()) {
+        std::cerr << fmt::format("Cannot write \"{}\"", temporary) << std::endl;
+        std::remove(temporary.c_str());
+        return 1;
+    }
+    if (std::rename(temporary.c_str(), output.c_str()) != 0) {
+        std::cerr << fmt::format("Cannot write \"{}\"", output) << std::endl;
+        return 1;
+    }
+    Schema schema = Schema::from_bytes(bytes);
+    std::cout << fmt::format("{}: {} types, {} directives, {} bytes, compiled in {:.1f} ms", output, schema.type_count(),
+            schema.directive_count(), bytes.size(), elapsed) << std::endl;
+    return 0;
+}
+
+int load(const std::string &path) {
+    auto started = std::chrono::steady_clock::now();
+    Schema schema = Schema::load(path);
+    std::cout << fmt::format("{}: {} types, {} directives, {} bytes, loaded in {:.3f} ms", path, schema.type_count(),
+            schema.directive_count(), schema.size(), milliseconds_since(started)) << std::endl;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    std::string command = argc > 1 ? argv[1] : "";
+    try {
+        if (command == "compile" && argc == 4)
+            return compile(argv[2], argv[3]);
+        if (command == "load" && argc == 3)
+            return load(argv[2]);
+        if (command == "print" && argc == 3) {
+            std::cout << print_schema(Schema::load(argv[2]));
+            return 0;
+        }
+    } catch (const GraphQLError &e) {
+        std::cerr << e.message << std::endl;
+        return 1;
+    }
+    std::cerr << "usage: schema_snapshot compile <schema.graphql> <schema.snapshot>" << std::endl;
+    std::cerr << "       schema_snapshot load <schema.snapshot>" << std::endl;
+    std::cerr << "       schema_snapshot print <schema.snapshot>" << std::endl;
+    return 2;
+}
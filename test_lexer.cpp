@@ -30,15 +30,87 @@ void assert_syntax_error(std::string text, std::string message, SourceLocation l
     }
 }
 
+std::vector<Token *> lex_all(Lexer *lexer) {
+    std::vector<Token *> tokens;
+    Token *token = nullptr;
+    do {
+        token = lexer->advance();
+        tokens.push_back(token);
+    } while (token->kind != TokenKind::EOF);
+    return tokens;
+}
+
+// Both lexers recover, so edits also have to keep the errors up to date.
+void assert_same_lex(Lexer *lexer, std::string text) {
+    std::vector<Token *> tokens = lex_all(lexer);
+    Lexer *expected = new Lexer(new Source(text), true);
+    std::vector<Token *> expected_tokens = lex_all(expected);
+    assert(tokens.size() == expected_tokens.size());
+    for (size_t i = 0; i < tokens.size(); i++)
+        assert(*tokens[i] == *expected_tokens[i]);
+    assert(lexer->errors.size() == expected->errors.size());
+    for (size_t i = 0; i < expected->errors.size(); i++) {
+        assert(lexer->errors[i].description == expected->errors[i].description);
+        assert(*lexer->errors[i].positions == *expected->errors[i].positions);
+        assert(*lexer->errors[i].locations == *expected->errors[i].locations);
+        assert(lexer->errors[i].body.view() == expected->errors[i].body.view());
+    }
+}
+
+void assert_edit(std::string text, int offset, int removed_length, std::string inserted) {
+    Lexer *lexer = new Lexer(new Source(text), true);
+    lex_all(lexer);
+    lexer->apply_edit(offset, removed_length, inserted);
+    assert_same_lex(lexer, text.replace(offset, removed_length, inserted));
+}
+
+// Edits a stream that has only been lexed up to its first `lexed` tokens.
+void assert_partial_edit(std::string text, int lexed, int offset, int removed_length, std::string inserted) {
+    Lexer *lexer = new Lexer(new Source(text), true);
+    for (int i = 0; i < lexed; i++)
+        lexer->advance();
+    lexer->apply_edit(offset, removed_length, inserted);
+    assert_same_lex(lexer, text.replace(offset, removed_length, inserted));
+}
+
+void assert_recovered(std::string text, std::vector<TokenKind> kinds, std::vector<SourceLocation> locations) {
+    Lexer *lexer = new Lexer(new Source(text), true);
+    std::vector<Token *> tokens = lex_all(lexer);
+    assert(tokens.size() == kinds.size());
+    for (size_t i = 0; i < tokens.size(); i++)
+        assert(tokens[i]->kind == kinds[i]);
+    assert(lexer->errors.size() == locations.size());
+    for (size_t i = 0; i < locations.size(); i++)
+        assert((*lexer->errors[i].locations)[0] == locations[i]);
+}
+
+void assert_token_buffer(std::string text, bool recover = false) {
+    Source *source = new Source(text);
+    std::vector<Token *> expected_tokens = lex_all(new Lexer(source, recover));
+    TokenBuffer tokens(source, recover);
+    assert(tokens.size() == expected_tokens.size());
+    TokenCursor cursor(&tokens);
+    for (Token *expected_token : expected_tokens) {
+        assert(cursor.kind() == expected_token->kind);
+        assert(cursor.start() == expected_token->start);
+        assert(cursor.end() == expected_token->end);
+        assert(cursor.location() == SourceLocation(expected_token->line, expected_token->column));
+        if (expected_token->value != nullptr)
+            assert(cursor.value() == *expected_token->value);
+        cursor.advance();
+    }
+    assert(cursor.kind() == TokenKind::EOF);
+}
+
 int main(int argc, char *argv[]) {
     Token *token = nullptr;
 
-    //token = lex_one("\ufeff foo");
-    //assert(*token == Token(TokenKind::NAME, 2, 5, 1, 3, nullptr, new std::string("foo")));
-    // TODO: Fix
+    token = lex_one("\ufeff foo");
+    Token expected_token = Token(TokenKind::NAME, 4, 7, 1, 3, nullptr, new std::string("foo"));
+    assert(*token == expected_token);
 
     token = lex_one("foo");
-    Token expected_token = Token(TokenKind::NAME, 0, 3, 1, 1, nullptr, new std::string("foo"));
+    expected_token = Token(TokenKind::NAME, 0, 3, 1, 1, nullptr, new std::string("foo"));
     assert(*token == expected_token);
 
     token = lex_one("\nfoo");
@@ -124,10 +196,17 @@ int main(int argc, char *argv[]) {
     expected_token = Token(TokenKind::STRING, 0, 15, 1, 1, nullptr, new std::string("slashes \\ /"));
     assert(*token == expected_token);
 
-    //token = lex_one("\"unicode \\u1234\\u5678\\u90AB\\uCDEF\"");
-    //expected_token = Token(TokenKind::STRING, 0, 34, 1, 1, nullptr, new std::string("unicode \u1234\u5678\u90AB\uCDEF"));
-    //assert(*token == expected_token);
-    // TODO: Fix
+    token = lex_one("\"unicode \\u1234\\u5678\\u90AB\\uCDEF\"");
+    expected_token = Token(TokenKind::STRING, 0, 34, 1, 1, nullptr, new std::string("unicode \u1234\u5678\u90AB\uCDEF"));
+    assert(*token == expected_token);
+
+    token = lex_one("\"surrogate \\uD83D\\uDE00\"");
+    expected_token = Token(TokenKind::STRING, 0, 24, 1, 1, nullptr, new std::string("surrogate \U0001F600"));
+    assert(*token == expected_token);
+
+    token = lex_second("\"h\u00e9llo\" world");
+    expected_token = Token(TokenKind::NAME, 9, 14, 1, 9, nullptr, new std::string("world"));
+    assert(*token == expected_token);
 
     assert_syntax_error("\"", "Unterminated string.", SourceLocation(1, 2));
     assert_syntax_error("\"\"\"", "Unterminated string.", SourceLocation(1, 4));
@@ -137,6 +216,10 @@ int main(int argc, char *argv[]) {
     //assert_syntax_error("\"contains unescaped \x07 control char\"", "Invalid character within String: '\\x07'.", SourceLocation(1, 21));
     //assert_syntax_error("\"null-byte is not \x00 end of file\"", "Invalid character within String: '\\x00'.", SourceLocation(1, 19));
     // TODO: Fix
+    assert_syntax_error("\"lone \\uD83D surrogate\"", "Invalid character escape sequence: uD83D", SourceLocation(1, 8));
+    assert_syntax_error("\"bad \xC3( utf-8\"", "Invalid UTF-8 sequence.", SourceLocation(1, 6));
+    assert_syntax_error("# overlong \xC0\xAF\nfoo", "Invalid UTF-8 sequence.", SourceLocation(1, 12));
+    assert_syntax_error("{ \xE2\x82\xAC }", "Cannot parse the unexpected character \xE2\x82\xAC.", SourceLocation(1, 3));
     assert_syntax_error("\"multi\nline\"", "Unterminated string.", SourceLocation(1, 7));
     assert_syntax_error("\"multi\rline\"", "Unterminated string.", SourceLocation(1, 7));
     //assert_syntax_error("\"bad \\x esc\"", "Invalid character escape sequence: '\\x'.", SourceLocation(1, 7));
@@ -283,5 +366,77 @@ int main(int argc, char *argv[]) {
     token = lex_one("-1.123e4567");
     expected_token = Token(TokenKind::FLOAT, 0, 11, 1, 1, nullptr, new std::string("-1.123e4567"));
     assert(*token == expected_token);
-}
 
+    assert_edit("{ a b c }", 3, 0, "x");
+    assert_edit("{ a b c }", 2, 0, "x ");
+    assert_edit("{\n  a\n  b\n  c\n}", 5, 0, "\n  d(e: 1)");
+    assert_edit("{\n  a\n  b\n  c\n}", 4, 4, "");
+    assert_edit("{\n  a #comment\n  b c\n}", 14, 0, "more");
+    assert_edit("{ a \"b\" c }", 4, 0, "\"\"\"\n\"\"\" ");
+    assert_edit("{ a b c }", 0, 9, "d");
+    assert_edit("{ a b c }", 9, 0, " e");
+    assert_edit("{ a ? b }", 4, 1, "c");
+    assert_edit("? { a b }", 6, 1, "c");
+    assert_edit("{ a ? b ? }\n?", 0, 1, "\n{");
+    assert_edit("{ a ? \"x\\q\" ?? }", 2, 1, "abc ?");
+    assert_edit("\"open ?", 1, 0, "\n");
+    assert_edit("{ a }\n\"\"\"\xff\"\"\" ? b", 2, 1, "");
+    assert_partial_edit("{ a ? b ? c ? d }", 3, 2, 1, "\r\n");
+    assert_partial_edit("\"\\q\"$x? $x?1.x", 3, 2, 1, "\n01");
+    assert_partial_edit("\"s\"1", 1, 0, 0, "\r\n1");
+    assert_partial_edit("{\n  a\n  b\n  c\n}", 2, 2, 3, "");
+    assert_partial_edit("{ a\n  b c\n}", 2, 3, 0, "\n\n  x");
+    assert_partial_edit("{ a b\n c }", 1, 0, 1, "# c\r\n{ ");
+
+    assert_recovered("{ ? a ?? }", {TokenKind::BRACE_L, TokenKind::NAME, TokenKind::BRACE_R, TokenKind::EOF},
+            {SourceLocation(1, 3), SourceLocation(1, 7), SourceLocation(1, 8)});
+    assert_recovered("01 1.x 2 -", {TokenKind::INT, TokenKind::FLOAT, TokenKind::INT, TokenKind::INT, TokenKind::EOF},
+            {SourceLocation(1, 2), SourceLocation(1, 6), SourceLocation(1, 11)});
+    assert_recovered("\"bad \\x esc\" \"no end\nfoo", {TokenKind::STRING, TokenKind::STRING, TokenKind::NAME, TokenKind::EOF},
+            {SourceLocation(1, 7), SourceLocation(1, 21)});
+    assert_recovered("a \"\"\"no end", {TokenKind::NAME, TokenKind::BLOCK_STRING, TokenKind::EOF},
+            {SourceLocation(1, 12)});
+    assert_recovered("\"a\\\nb ?", {TokenKind::STRING, TokenKind::NAME, TokenKind::EOF},
+            {SourceLocation(1, 4), SourceLocation(1, 4), SourceLocation(2, 3)});
+    assert_recovered("a ?\r\n\u00e9 ?\r\"\"\"x\n\xff\ny\"\"\" ?", {TokenKind::NAME, TokenKind::BLOCK_STRING, TokenKind::EOF},
+            {SourceLocation(1, 3), SourceLocation(2, 1), SourceLocation(2, 3), SourceLocation(4, 1), SourceLocation(5, 6)});
+
+    assert_token_buffer("query Q($id: ID = 4) {\n  user(id: $id, tags: [\"a\\n\", \"b\"]) { ...F }\n}\n");
+    assert_token_buffer("# comment\r\n{\r\n  \"\"\"\n    block\n  \"\"\" a: 1.5e3 # trailing\r  b\n}");
+    assert_token_buffer("\"a\\x\\u12G4\\uD800z\\\"\" \"\\u00e9\\uD83D\\uDE00\" \"open\\\n\"\"\"\n  x\\\"\"\"\n  y\"\"\" \"\"\"  no end\\", true);
+
+    Source *shared_source = new Source("query { viewer }");
+    TokenBuffer *shared_tokens = new TokenBuffer(shared_source);
+    Lexer *shared_lexer = new Lexer(shared_source);
+    Token *viewer = lex_all(shared_lexer)[2];
+    SourceSlice viewer_slice = shared_lexer->slice(viewer);
+    GraphQLError shared_error("Unknown field.", shared_source);
+    Token *me = shared_lexer->apply_edit(8, 6, "me");
+    assert(viewer_slice.view() == "viewer");
+    assert(shared_lexer->slice(me).view() == "me");
+    delete shared_source;
+    assert(shared_tokens->slice(2).view() == "viewer");
+    assert(shared_tokens->value(2) == "viewer");
+    assert(shared_error.body.view() == "query { viewer }");
+
+    // Errors located from the source end lines where the lexer does
+    Source *carriage_returns = new Source("a\rb ?\r\nc\n\rd");
+    Lexer *carriage_lexer = new Lexer(carriage_returns, true);
+    lex_all(carriage_lexer);
+    assert(*carriage_lexer->errors[0].locations == *GraphQLError("Unexpected.", carriage_returns, new std::vector<int>{4}).locations);
+    assert((*GraphQLError("Unexpected.", carriage_returns, new std::vector<int>{4}).locations)[0] == SourceLocation(2, 3));
+    assert((*GraphQLError("Unexpected.", carriage_returns, new std::vector<int>{10}).locations)[0] == SourceLocation(5, 1));
+
+    Lexer *pooled_lexer = LexerPool::acquire(new Source("{ a(b: \"a string longer than the small buffer\") }"));
+    lex_all(pooled_lexer);
+    LexerPool::release(pooled_lexer);
+    std::string reused_text = "query Q { name(format: \"\"\" block \"\"\") } # done";
+    Lexer *reused_lexer = LexerPool::acquire(new Source(reused_text), true);
+    assert(reused_lexer == pooled_lexer);
+    std::vector<Token *> reused_tokens = lex_all(reused_lexer);
+    std::vector<Token *> fresh_tokens = lex_all(new Lexer(new Source(reused_text)));
+    assert(reused_tokens.size() == fresh_tokens.size());
+    for (size_t i = 0; i < reused_tokens.size(); i++)
+        assert(*reused_tokens[i] == *fresh_tokens[i]);
+    LexerPool::release(reused_lexer);
+}
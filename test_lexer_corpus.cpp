@@ -0,0 +1,124 @@
+#include "graphql-cpp.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include <fmt/core.h>
+
+using namespace graphql;
+
+// Differential test against the reference lexer. Every corpus/lexer/<case>.graphql has a matching
+// <case>.tokens file produced by corpus/generate.js from graphql-js 15.8.0; this binary lexes the
+// same input and compares the token streams line by line.
+
+// Cases where this lexer is known to disagree with graphql-js. They are reported but do not fail
+// the run; once one of them starts matching it has to be removed from here.
+std::unordered_set<std::string> known_divergences {};
+
+std::string escape_json(const std::string &value) {
+    std::string escaped = "\"";
+    for (char character : value) {
+        switch (character) {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\b':
+                escaped += "\\b";
+                break;
+            case '\f':
+                escaped += "\\f";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\r':
+                escaped += "\\r";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(character) < ' ')
+                    escaped += fmt::format("\\u{:04x}", static_cast<int>(character));
+                else
+                    escaped += character;
+        }
+    }
+    return escaped + "\"";
+}
+
+std::string describe_token(Token *token) {
+    std::string description = fmt::format("{} {} {} {} {}", token_kind_value(token->kind), token->start, token->end, token->line, token->column);
+    if (token->value != nullptr)
+        description += " " + escape_json(*token->value);
+    return description;
+}
+
+std::vector<std::string> lex_lines(std::string body) {
+    std::vector<std::string> lines;
+    Lexer *lexer = new Lexer(new Source(body));
+    try {
+        Token *token = nullptr;
+        do {
+            token = lexer->advance();
+            lines.push_back(describe_token(token));
+        } while (token->kind != TokenKind::EOF);
+    } catch (const GraphQLSyntaxError &e) {
+        SourceLocation location = (*e.locations)[0];
+        lines.push_back(fmt::format("error {} {}", location.line, location.column));
+    }
+    return lines;
+}
+
+std::string read_file(std::filesystem::path path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char *argv[]) {
+    std::filesystem::path directory = argc > 1 ? argv[1] : "corpus/lexer";
+    std::vector<std::filesystem::path> cases;
+    for (auto &entry : std::filesystem::directory_iterator(directory))
+        if (entry.path().extension() == ".graphql")
+            cases.push_back(entry.path());
+    std::sort(cases.begin(), cases.end());
+
+    int failures = 0;
+    for (auto &path : cases) {
+        std::string name = path.stem().string();
+        std::vector<std::string> actual = lex_lines(read_file(path));
+        std::vector<std::string> expected = split_string(read_file(std::filesystem::path(path).replace_extension(".tokens")), "\n");
+        if (!expected.empty() && expected.back().empty())
+            expected.pop_back();
+
+        bool known = known_divergences.count(name) > 0;
+        if (actual == expected) {
+            if (known) {
+                std::cout << "FIXED " << name << ": remove it from known_divergences" << std::endl;
+                failures += 1;
+            }
+            continue;
+        }
+
+        std::cout << (known ? "KNOWN " : "FAIL ") << name << std::endl;
+        for (size_t i = 0; i < std::max(actual.size(), expected.size()); i++) {
+            std::string actual_line = i < actual.size() ? actual[i] : "<none>";
+            std::string expected_line = i < expected.size() ? expected[i] : "<none>";
+            if (actual_line != expected_line) {
+                std::cout << "  expected: " << expected_line << std::endl;
+                std::cout << "  actual:   " << actual_line << std::endl;
+                break;
+            }
+        }
+        if (!known)
+            failures += 1;
+    }
+
+    std::cout << cases.size() << " cases, " << failures << " failures" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,487 @@
+#include "graphql-cpp.hpp"
+
+#include <cassert>
+#include <functional>
+#include <iostream>
+
+#include <fmt/core.h>
+
+using namespace graphql;
+
+void assert_syntax_error_in(std::function<void()> action, std::string message, SourceLocation location) {
+    try {
+        action();
+        assert(false);
+    } catch (const GraphQLSyntaxError &e) {
+        assert(e.description == message);
+        std::vector<SourceLocation> locations{location};
+        assert(*e.locations == locations);
+    }
+}
+
+void assert_syntax_error(std::string text, std::string message, SourceLocation location) {
+    assert_syntax_error_in([&]() { parse(new Source(text)); }, message, location);
+}
+
+void assert_error(std::function<void()> action, std::string message) {
+    try {
+        action();
+        assert(false);
+    } catch (const GraphQLError &e) {
+        assert(e.message == message);
+    }
+}
+
+FieldNode *field_at(SelectionSetNode *selection_set, int index) {
+    assert(selection_set->selections[index]->kind == SelectionKind::FIELD);
+    return static_cast<FieldNode *>(selection_set->selections[index]);
+}
+
+// Edits a recovering token buffer in place and compares it with one lexed from the edited text.
+void assert_buffer_edit(std::string text, int offset, int removed_length, std::string inserted) {
+    TokenBuffer tokens(new Source(text), true);
+    tokens.location(0);
+    tokens.apply_edit(offset, removed_length, inserted);
+    TokenBuffer expected(new Source(text.replace(offset, removed_length, inserted)), true);
+    assert(tokens.source.body() == text);
+    assert(tokens.kinds == expected.kinds && tokens.starts == expected.starts && tokens.ends == expected.ends);
+    assert(tokens.signature == expected.signature);
+    for (size_t index = 0; index < tokens.size(); index++)
+        assert(tokens.location(index) == expected.location(index));
+    assert(tokens.errors.size() == expected.errors.size());
+    for (size_t index = 0; index < tokens.errors.size(); index++) {
+        assert(tokens.errors[index].description == expected.errors[index].description);
+        assert(*tokens.errors[index].positions == *expected.errors[index].positions);
+        assert(*tokens.errors[index].locations == *expected.errors[index].locations);
+        assert(tokens.errors[index].body.view() == text);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Parses an operation with every executable construct
+    {
+        std::string text =
+            "query Q($id: ID!, $ids: [ID!]! = [\"a\"], $f: Float @deprecated) @live {\n"
+            "  node(id: $id) { ... on User { name } ...F }\n"
+            "  alias: search(q: \"\"\"text\"\"\", first: 10, scale: 1.5, on: true, none: null, kind: USER, where: {a: [$id, 2]})\n"
+            "}\n"
+            "fragment F on Node @include(if: true) { id }\n";
+        DocumentNode *document = parse(new Source(text));
+        assert(document->start == 0 && document->end == (int) text.length() - 1);
+        assert(document->definitions.size() == 2);
+
+        OperationDefinitionNode *operation = document->get_operation();
+        assert(operation->operation == OperationType::QUERY && operation->name == "Q");
+        assert(operation->variable_definitions.size() == 3);
+        assert(print_type(operation->variable_definitions[1]->type) == "[ID!]!");
+        assert(operation->variable_definitions[1]->default_value->kind == ValueKind::LIST_VALUE);
+        assert(operation->variable_definitions[2]->directives[0]->name == "deprecated");
+        assert(operation->directives[0]->name == "live");
+
+        FieldNode *node = field_at(operation->selection_set, 0);
+        assert(node->name == "node" && node->response_name() == "node");
+        assert(node->arguments[0]->value->kind == ValueKind::VARIABLE && node->arguments[0]->value->value == "id");
+        InlineFragmentNode *inline_fragment = static_cast<InlineFragmentNode *>(node->selection_set->selections[0]);
+        assert(inline_fragment->kind == SelectionKind::INLINE_FRAGMENT && inline_fragment->type_condition == "User");
+        assert(static_cast<FragmentSpreadNode *>(node->selection_set->selections[1])->name == "F");
+
+        FieldNode *search = field_at(operation->selection_set, 1);
+        assert(search->alias == "alias" && search->response_name() == "alias");
+        assert(text.substr(search->start, search->end - search->start).rfind("alias: search(", 0) == 0);
+        std::vector<ValueKind> kinds{ValueKind::STRING_VALUE, ValueKind::INT_VALUE, ValueKind::FLOAT_VALUE, ValueKind::BOOLEAN_VALUE,
+            ValueKind::NULL_VALUE, ValueKind::ENUM_VALUE, ValueKind::OBJECT_VALUE};
+        for (size_t i = 0; i < kinds.size(); i++)
+            assert(search->arguments[i]->value->kind == kinds[i]);
+        assert(search->arguments[0]->value->value == "text" && search->arguments[0]->value->block);
+
+        FragmentDefinitionNode *fragment = document->get_fragment("F");
+        assert(fragment->type_condition == "Node" && fragment->directives[0]->arguments[0]->name == "if");
+        delete document;
+    }
+
+    // Parses the query shorthand and selects operations by name
+    {
+        DocumentNode *document = parse(new Source("{ a } query B { b }"));
+        assert_error([&]() { document->get_operation(); }, "Must provide operation name if query contains multiple operations.");
+        assert_error([&]() { document->get_operation("C"); }, "Unknown operation named \"C\".");
+        assert(field_at(document->get_operation("B")->selection_set, 0)->name == "b");
+        delete document;
+    }
+
+    // Reports syntax errors like graphql-js
+    assert_syntax_error("", "Unexpected <EOF>.", SourceLocation(1, 1));
+    assert_syntax_error("{", "Expected Name, found <EOF>.", SourceLocation(1, 2));
+    assert_syntax_error("{ a(b: 1 }", "Expected Name, found \"}\".", SourceLocation(1, 10));
+    assert_syntax_error("query Q($a: Int = $b) { a }", "Unexpected \"$\".", SourceLocation(1, 19));
+    assert_syntax_error("fragment on on T { a }", "Unexpected Name \"on\".", SourceLocation(1, 10));
+    assert_syntax_error("fragment F T { a }", "Expected \"on\", found Name \"T\".", SourceLocation(1, 12));
+    assert_syntax_error("{ a(b: \"c) }", "Unterminated string.", SourceLocation(1, 13));
+
+    // Errors keep their source after the parser that threw them is gone
+    try {
+        parse(new Source("{ a(b: ) }", "request.graphql"));
+        assert(false);
+    } catch (GraphQLSyntaxError &e) {
+        assert(e.source->name == "request.graphql" && e.source->body() == "{ a(b: ) }");
+        assert(e.body.view() == "{ a(b: ) }");
+    }
+
+    // Parses type system definitions and extensions
+    {
+        std::string text =
+            "schema @a { query: Q mutation: M }\n"
+            "\"\"\"\n  Scalar description\n\"\"\"\nscalar Date @specifiedBy(url: \"x\")\n"
+            "type Q implements & I & J @key { \"field\" f(a: Int = 1, \"arg\" b: [In!]! @d): String @deprecated }\n"
+            "interface I implements J { f: String }\n"
+            "union U = | Q | M\n"
+            "enum E { A \"b\" B @deprecated }\n"
+            "input In { a: E = A, b: In }\n"
+            "directive @d(r: String) repeatable on | FIELD_DEFINITION | ARGUMENT_DEFINITION\n"
+            "extend type Q { g: Int }\n"
+            "extend schema @b\n"
+            "extend union U = E\n";
+        DocumentNode *document = parse(new Source(text));
+        assert(document->definitions.size() == 11);
+        SchemaDefinitionNode *schema = static_cast<SchemaDefinitionNode *>(document->definitions[0]);
+        assert(schema->kind == SCHEMA_DEFINITION && schema->directives[0]->name == "a");
+        assert(schema->operation_types[1].first == MUTATION && schema->operation_types[1].second == "M");
+        TypeDefinitionNode *scalar = static_cast<TypeDefinitionNode *>(document->definitions[1]);
+        assert(scalar->kind == SCALAR_TYPE_DEFINITION && scalar->description == "Scalar description" && scalar->name == "Date");
+        TypeDefinitionNode *object = static_cast<TypeDefinitionNode *>(document->definitions[2]);
+        assert(object->kind == OBJECT_TYPE_DEFINITION && object->interfaces == std::vector<std::string>({"I", "J"}));
+        FieldDefinitionNode *field = object->fields[0];
+        assert(field->description == "field" && field->name == "f" && print_type(field->type) == "String");
+        assert(field->arguments[0]->default_value->value == "1" && field->arguments[1]->description == "arg");
+        assert(print_type(field->arguments[1]->type) == "[In!]!" && field->arguments[1]->directives[0]->name == "d");
+        assert(static_cast<TypeDefinitionNode *>(document->definitions[3])->interfaces[0] == "J");
+        assert(static_cast<TypeDefinitionNode *>(document->definitions[4])->types == std::vector<std::string>({"Q", "M"}));
+        TypeDefinitionNode *enumeration = static_cast<TypeDefinitionNode *>(document->definitions[5]);
+        assert(enumeration->values[1]->description == "b" && enumeration->values[1]->directives[0]->name == "deprecated");
+        TypeDefinitionNode *input = static_cast<TypeDefinitionNode *>(document->definitions[6]);
+        assert(input->kind == INPUT_OBJECT_TYPE_DEFINITION && input->input_fields[0]->default_value->kind == ValueKind::ENUM_VALUE);
+        DirectiveDefinitionNode *directive = static_cast<DirectiveDefinitionNode *>(document->definitions[7]);
+        assert(directive->repeatable && directive->locations == std::vector<std::string>({"FIELD_DEFINITION", "ARGUMENT_DEFINITION"}));
+        TypeDefinitionNode *extension = static_cast<TypeDefinitionNode *>(document->definitions[8]);
+        assert(extension->extension && extension->name == "Q" && extension->fields[0]->name == "g");
+        assert(static_cast<SchemaDefinitionNode *>(document->definitions[9])->extension);
+        assert(static_cast<TypeDefinitionNode *>(document->definitions[10])->types[0] == "E");
+        delete document;
+    }
+
+    assert_syntax_error("type A { }", "Expected Name, found \"}\".", SourceLocation(1, 10));
+    assert_syntax_error("extend type A", "Unexpected <EOF>.", SourceLocation(1, 14));
+    assert_syntax_error("extend query", "Unexpected Name \"query\".", SourceLocation(1, 8));
+    assert_syntax_error("\"d\" extend type A @a", "Unexpected Name \"extend\".", SourceLocation(1, 5));
+    assert_syntax_error("\"d\" { a }", "Unexpected \"{\".", SourceLocation(1, 5));
+    assert_syntax_error("directive @a on FIELD | WHERE", "Unexpected Name \"WHERE\".", SourceLocation(1, 25));
+    assert_syntax_error("type A { a(b: Int = $c): Int }", "Unexpected \"$\".", SourceLocation(1, 21));
+    assert_syntax_error("schema { query }", "Expected \":\", found \"}\".", SourceLocation(1, 16));
+
+    // Converts literal arguments once and coerces variables per request
+    {
+        DocumentNode *document = parse(new Source(
+                "query Q($id: ID!, $first: Int = 10, $tags: [String], $scale: Float) {\n"
+                "  user(id: $id) { friends(first: $first, after: \"x\") { ...F } }\n"
+                "  search(tags: $tags, filter: {tags: $tags, scale: $scale, limit: 5}, list: [$scale, 1])\n"
+                "}\n"
+                "fragment F on User { name(format: UPPER) ...F2 }\n"
+                "fragment F2 on User { name(format: UPPER) }\n"));
+        ArgumentPlan *plan = document->argument_plan();
+        assert(document->argument_plan() == plan);
+        assert(plan->fields.size() == 5);
+        assert(plan->fields[1].arguments[1].value == Value::string("x") && !plan->fields[1].arguments[1].has_variables);
+        assert(plan->field_index(field_at(document->get_operation()->selection_set, 1)) == 4);
+
+        std::vector<ArgumentValues> values = plan->resolve({{"id", Value::integer(4)}, {"tags", Value::string("a")}});
+        assert((values[0] == ArgumentValues{{"id", Value::string("4")}}));
+        assert((values[1] == ArgumentValues{{"first", Value::integer(10)}, {"after", Value::string("x")}}));
+        assert((values[2] == ArgumentValues{{"format", Value::enumeration("UPPER")}}));
+        assert(values[3] == values[2]);
+        assert((values[4] == ArgumentValues{
+                    {"tags", Value::list({Value::string("a")})},
+                    {"filter", Value::object({{"tags", Value::list({Value::string("a")})}, {"limit", Value::integer(5)}})},
+                    {"list", Value::list({Value::null(), Value::integer(1)})}}));
+
+        values = plan->resolve({{"id", Value::string("u")}, {"first", Value::floating(3)}, {"scale", Value::integer(2)}});
+        assert((values[1][0] == std::pair<std::string, Value>("first", Value::integer(3))));
+        assert((values[4][0] == std::pair<std::string, Value>("filter", Value::object({{"scale", Value::floating(2)}, {"limit", Value::integer(5)}}))));
+
+        assert_error([&]() { plan->resolve({}); }, "Variable \"$id\" of required type \"ID!\" was not provided.");
+        assert_error([&]() { plan->resolve({{"id", Value::null()}}); }, "Variable \"$id\" of non-null type \"ID!\" must not be null.");
+        assert_error([&]() { plan->resolve({{"id", Value::boolean(true)}}); }, "Variable \"$id\" got invalid value true; ID cannot represent value: true");
+        assert_error([&]() { plan->resolve({{"id", Value::string("u")}, {"first", Value::floating(1.5)}}); },
+                "Variable \"$first\" got invalid value 1.5; Int cannot represent non-integer value: 1.5");
+        assert_error([&]() { plan->resolve({{"id", Value::string("u")}, {"tags", Value::list({Value::string("a"), Value::integer(1)})}}); },
+                "Variable \"$tags\" got invalid value [\"a\", 1]; String cannot represent a non string value: 1");
+        delete document;
+    }
+
+    // Rejects undefined variables when planning, and keeps Int literals that do not fit 32 bits
+    {
+        DocumentNode *document = parse(new Source("query A { a(b: $c) } query B { a(b: 2147483648, c: -9007199254740993, d: 99999999999999999999) }"));
+        assert_error([&]() { document->argument_plan("A"); }, "Variable \"$c\" is not defined by operation \"A\".");
+        ArgumentValues values = document->argument_plan("B")->resolve({})[0];
+        assert(values[0].second == Value::integer(2147483648) && values[1].second == Value::integer(-9007199254740993));
+        assert(values[2].second == Value::floating(1e20));
+        std::string error;
+        coerce_scalar(values[0].second, "Int", error);
+        assert(error == "Int cannot represent non 32-bit signed integer value: 2147483648");
+        delete document;
+    }
+
+    // Coerces variable defaults like provided values and reports bad ones at the default
+    {
+        DocumentNode *document = parse(new Source("query Q($a: Int = 1.5) { f(a: $a) } query R($b: Float = 2, $c: [ID] = 3) { f(b: $b, c: $c) }"));
+        try {
+            document->argument_plan("Q");
+            assert(false);
+        } catch (const GraphQLError &e) {
+            assert(e.message == "Variable \"$a\" has invalid default value 1.5; Int cannot represent non-integer value: 1.5");
+            assert((*e.locations)[0] == SourceLocation(1, 19));
+        }
+        assert((document->argument_plan("R")->resolve({})[0] == ArgumentValues{{"b", Value::floating(2)}, {"c", Value::list({Value::string("3")})}}));
+        delete document;
+
+        // Defaults that are literal slots are coerced once bound
+        PlanCache cache(2, PossibleTypes{});
+        auto first = std::make_shared<TokenBuffer>(new Source("query Q($b: Float = 2) { f(b: $b) }"));
+        auto second = std::make_shared<TokenBuffer>(new Source("query Q($b: Float = 3) { f(b: $b) }"));
+        auto invalid = std::make_shared<TokenBuffer>(new Source("query Q($b: Float = \"x\") { f(b: $b) }"));
+        std::shared_ptr<const PreparedOperation> prepared = cache.prepare(first, "Q");
+        assert(cache.prepare(second, "Q") == prepared && prepared->resolve(*second, {})[0][0].second == Value::floating(3));
+        try {
+            cache.prepare(invalid, "Q")->resolve(*invalid, {});
+            assert(false);
+        } catch (const GraphQLError &e) {
+            assert(e.message == "Variable \"$b\" has invalid default value \"x\"; Float cannot represent non numeric value: \"x\"");
+            assert((*e.locations)[0] == SourceLocation(1, 21));
+        }
+    }
+
+    // Flattens fragments per concrete type and keeps variable conditions
+    {
+        PossibleTypes possible_types{{"Node", {"User", "Page"}}, {"Actor", {"User"}}};
+        DocumentNode *document = parse(new Source(
+                "query Q($more: Boolean!, $skip: Boolean = true) {\n"
+                "  node { id ...N ... on Page { title } ... on Actor @include(if: $more) { login } }\n"
+                "  hidden @skip(if: true) shown @include(if: true) maybe @skip(if: $skip)\n"
+                "}\n"
+                "fragment N on Node { id name: login ...A }\n"
+                "fragment A on Actor { avatar { url } }\n"));
+        FieldPlanner *planner = document->field_planner(possible_types);
+        assert(document->field_planner(possible_types) == planner);
+
+        const FieldPlan *root = planner->plan(document->get_operation()->selection_set, "Query");
+        assert(root == planner->plan(document->get_operation()->selection_set, "Query"));
+        assert(root->fields.size() == 3 && root->conditional);
+        assert(root->fields[0].response_name == "node" && root->fields[1].response_name == "shown" && root->fields[2].response_name == "maybe");
+        assert((root->fields[2].nodes[0].conditions == std::vector<FieldCondition>{{"skip", false}}));
+
+        const FieldPlan *user = planner->plan(&root->fields[0], "User");
+        std::vector<std::string> names;
+        for (auto &field : user->fields)
+            names.push_back(field.response_name);
+        assert((names == std::vector<std::string>{"id", "name", "avatar", "login"}));
+        assert(user->fields[0].nodes.size() == 2 && user->fields[0].nodes[0].node != user->fields[0].nodes[1].node);
+        assert((user->fields[3].nodes[0].conditions == std::vector<FieldCondition>{{"more", true}}));
+        assert(planner->plan(&user->fields[2], "Avatar")->fields[0].response_name == "url");
+
+        const FieldPlan *page = planner->plan(&root->fields[0], "Page");
+        names.clear();
+        for (auto &field : page->fields)
+            names.push_back(field.response_name);
+        assert((names == std::vector<std::string>{"id", "name", "title"}));
+        assert(!page->conditional);
+
+        ArgumentPlan *arguments = document->argument_plan();
+        std::map<std::string, Value> variables = arguments->variable_values({{"more", Value::boolean(false)}});
+        assert(user->select(variables).size() == 3);
+        assert(root->select(variables).size() == 2);
+        variables = arguments->variable_values({{"more", Value::boolean(true)}, {"skip", Value::boolean(false)}});
+        assert(user->select(variables).size() == 4);
+        assert(root->select(variables).size() == 3);
+        delete document;
+    }
+
+    // Skims definitions and parses only the selected operation and the fragments it needs
+    {
+        std::string text =
+            "query A { a(x: {y: [1, 2]}) { ...F } }\n"
+            "fragment Broken on T { b(c: ) }\n"
+            "subscription B($v: In = {w: 1}) @d(e: [{f: 2}]) { b { ...G ... on T { c } } }\n"
+            "fragment G on T { g ...H }\n"
+            "fragment F on T { f }\n"
+            "fragment H on T { h ...G }\n";
+        DocumentIndex index(new Source(text));
+        assert(index.complete && index.definitions.size() == 6);
+        assert(index.definitions[2].kind == DefinitionKind::OPERATION_DEFINITION && index.definitions[2].operation == OperationType::SUBSCRIPTION);
+        assert(index.definitions[2].name == "B" && text.substr(index.definitions[2].start, 14) == "subscription B");
+        assert(text[index.definitions[2].end - 1] == '}' && text[index.definitions[2].end] == '\n');
+        assert((index.definitions[5].fragment_spreads == std::vector<std::string>{"G"}));
+        assert_error([&]() { index.get_operation(); }, "Must provide operation name if query contains multiple operations.");
+
+        DocumentNode *document = index.parse_operation("B");
+        std::vector<std::string> names;
+        for (auto definition : document->definitions)
+            names.push_back(definition->kind == DefinitionKind::OPERATION_DEFINITION
+                    ? static_cast<OperationDefinitionNode *>(definition)->name : static_cast<FragmentDefinitionNode *>(definition)->name);
+        assert((names == std::vector<std::string>{"B", "G", "H"}));
+        assert(document->get_operation()->operation == OperationType::SUBSCRIPTION);
+        assert(document->argument_plan()->fields.size() == 4);
+        delete document;
+
+        document = index.parse_operation("A");
+        assert(document->definitions.size() == 2 && document->get_fragment("F") != nullptr);
+        delete document;
+        assert_syntax_error(text, "Unexpected \")\".", SourceLocation(2, 29));
+    }
+
+    // Falls back to a full parse when the skim cannot follow the document
+    assert_syntax_error_in([]() { DocumentIndex(new Source("query A { a } }")).parse_operation(); }, "Unexpected \"}\".", SourceLocation(1, 15));
+    assert_syntax_error_in([]() { DocumentIndex(new Source("query A { a ")).parse_operation(); }, "Expected Name, found <EOF>.", SourceLocation(1, 13));
+    assert_syntax_error_in([]() { DocumentIndex(new Source("{ a(b: [}) }")).parse_operation(); }, "Unexpected \"}\".", SourceLocation(1, 9));
+
+    // Reuses parsers, token buffers and nodes across documents
+    {
+        std::string first = "query A($a: [In!] = [{b: \"a string longer than the small buffer\"}]) { a(b: $a) @c { ...F } } fragment F on T { f }";
+        std::string second = "subscription { s(x: \"\"\" block \"\"\", y: [1, 2.5, E]) { ... on T @skip(if: $v) { t: u } } }";
+        Parser *parser = ParserPool::acquire(new Source(first));
+        DocumentNode *document = parser->parse_document();
+        document->argument_plan();
+        ParserPool::release(parser, document);
+
+        Parser *reused = ParserPool::acquire(new Source("{ a(b: ) }"));
+        assert(reused == parser);
+        assert_syntax_error_in([&]() { reused->parse_document(); }, "Unexpected \")\".", SourceLocation(1, 8));
+        reused->reset(new Source(second));
+        document = reused->parse_document();
+        DocumentNode *expected = parse(new Source(second));
+        assert(document->nodes.size() == expected->nodes.size());
+        for (size_t i = 0; i < document->nodes.size(); i++) {
+            assert(typeid(*document->nodes[i]) == typeid(*expected->nodes[i]));
+            assert(document->nodes[i]->start == expected->nodes[i]->start && document->nodes[i]->end == expected->nodes[i]->end);
+        }
+        assert(document->start == expected->start && document->end == expected->end);
+        assert(document->definitions.size() == 1 && document->fragments.empty());
+        FieldNode *field = field_at(document->get_operation()->selection_set, 0);
+        assert(field->arguments[0]->value->value == " block " && field->arguments[1]->value->values[2]->value == "E");
+        InlineFragmentNode *fragment = static_cast<InlineFragmentNode *>(field->selection_set->selections[0]);
+        assert(fragment->type_condition == "T" && field_at(fragment->selection_set, 0)->alias == "t");
+        assert(document->argument_plan()->resolve({})[0] == expected->argument_plan()->resolve({})[0]);
+        ParserPool::release(reused, document);
+        delete expected;
+    }
+
+    // Re-lexes a token buffer only around an edit
+    assert_buffer_edit("{ a b c }", 4, 1, "xyz");
+    assert_buffer_edit("{ a }\n{ b }\n{ c }", 7, 0, "\"\"\"\n\n\"\"\" ");
+    assert_buffer_edit("{ a }\r\n{ b }", 5, 1, "");
+    assert_buffer_edit("{ a ? b }\n{ c ? }", 4, 1, "d");
+    assert_buffer_edit("{ a ? b }\n{ c ? }\n?", 0, 0, "?\n");
+    assert_buffer_edit("# c\xff\n{ a }", 3, 1, "");
+    assert_buffer_edit("{ a(b: 1) @d(e: 2) }", 16, 1, "3.5");
+    assert_buffer_edit("union U = A | B\nunion U = A | B\n", 16, 12, "");
+    assert_buffer_edit("{ a }", 0, 5, "");
+
+    // Parses an edited document again, keeping the definitions the edit leaves alone
+    {
+        std::string text = "query A { a }\nfragment F on T { f(x: \"y\") }\n{ b ...F }\n";
+        Parser *parser = new Parser(new Source(text));
+        DocumentNode *document = parser->parse_document();
+        std::vector<DefinitionNode *> definitions = document->definitions;
+        int position = text.find("f(x");
+        parser->reset(document, position, 1, "g");
+        document = parser->parse_document();
+        assert(document->definitions.size() == 3 && document->definitions[0] == definitions[0] && document->definitions[2] == definitions[2]);
+        assert(document->get_fragment("F") == document->definitions[1] && field_at(document->get_fragment("F")->selection_set, 0)->name == "g");
+
+        parser->reset(document, 0, 0, "# moved\n");
+        document = parser->parse_document();
+        assert(document->definitions.size() == 3 && document->definitions[2] == definitions[2]);
+        assert(document->get_fragment("F") == document->definitions[1]);
+        DocumentNode *expected = parse(new Source("# moved\n" + text.replace(position, 1, "g")));
+        assert(document->source().body() == expected->source().body());
+        assert(document->nodes.size() == expected->nodes.size());
+        for (size_t index = 0; index < expected->definitions.size(); index++) {
+            assert(document->definitions[index]->start == expected->definitions[index]->start);
+            assert(document->definitions[index]->end == expected->definitions[index]->end);
+        }
+        assert(field_at(document->get_operation("A")->selection_set, 0)->start == field_at(expected->get_operation("A")->selection_set, 0)->start);
+        delete expected;
+
+        // The token after a definition decides where it ends
+        parser->recycle(document);
+        parser->reset(new Source("union U = A | B\nunion V = C | D\n"));
+        document = parser->parse_document();
+        parser->reset(document, 16, 12, "");
+        document = parser->parse_document();
+        assert(document->definitions.size() == 1 && static_cast<TypeDefinitionNode *>(document->definitions[0])->types.size() == 3);
+        assert_syntax_error_in([&]() { parser->reset(document, 0, 5, "{"); parser->parse_document(); }, "Expected Name, found \"=\".", SourceLocation(1, 5));
+        delete parser;
+    }
+
+    // Hashes the shape of a document while lexing, ignoring literal values and formatting
+    {
+        TokenBuffer first(new Source("query Q($a: Int = 1) { f(x: 10, y: \"s\", z: [1.5]) @skip(if: false) { g } }"));
+        TokenBuffer second(new Source("# comment\nquery Q( $a : Int = 2 ) {\n  f(x: -3, y: \"\"\"t\"\"\" z: [2.0]) @skip(if: false) {\n    g\n  }\n}\n"));
+        TokenBuffer renamed(new Source("query Q($a: Int = 1) { f(x: 10, y: \"s\", z: [1.5]) @skip(if: false) { h } }"));
+        TokenBuffer other_literal(new Source("query Q($a: Int = 1) { f(x: 10, y: 1, z: [1.5]) @skip(if: false) { g } }"));
+        TokenBuffer other_boolean(new Source("query Q($a: Int = 1) { f(x: 10, y: \"s\", z: [1.5]) @skip(if: true) { g } }"));
+        assert(first.signature == second.signature && first.same_signature(second));
+        assert(first.signature != renamed.signature && !first.same_signature(renamed));
+        assert(first.signature != other_literal.signature && first.signature != other_boolean.signature);
+        assert(TokenBuffer(new Source("{ ab c }")).signature != TokenBuffer(new Source("{ a bc }")).signature);
+        TokenBuffer light(new Source("{ f @cost(weight: 1) { g(x: 1) } }"));
+        TokenBuffer heavy(new Source("{ f @cost(weight: 1000) { g(x: 1) } }"));
+        assert(light.signature != heavy.signature && !light.same_signature(heavy));
+        assert(light.same_signature(TokenBuffer(new Source("{ f @cost(weight: 1) { g(x: 2) } }"))));
+    }
+
+    // Shares prepared operations between requests with the same signature
+    {
+        PlanCache cache(2, PossibleTypes{{"Node", {"User"}}});
+        std::string fragment = " fragment F on Node { ... on User { name(format: \"short\") } }";
+        auto first = std::make_shared<TokenBuffer>(new Source("query Q($n: Int = 5) { users(first: 10, after: \"x\", n: $n) { id ...F } }" + fragment));
+        auto second = std::make_shared<TokenBuffer>(new Source("query Q($n: Int = 7) {\n  users(first: 20 after: \"\"\"y\"\"\" n: $n) { id ...F }\n}\n" + fragment));
+        std::shared_ptr<const PreparedOperation> prepared = cache.prepare(first, "Q");
+        assert(cache.prepare(second, "Q") == prepared);
+        assert(prepared->arguments->literals.size() == 4 && prepared->root->fields[0].response_name == "users");
+        assert(prepared->planner->plan(&prepared->root->fields[0], "User")->fields.size() == 2);
+
+        std::vector<ArgumentValues> values = prepared->resolve(*first, {});
+        assert((values[0] == ArgumentValues{{"first", Value::integer(10)}, {"after", Value::string("x")}, {"n", Value::integer(5)}}));
+        assert((values[2] == ArgumentValues{{"format", Value::string("short")}}));
+        values = prepared->resolve(*second, {{"n", Value::integer(1)}});
+        assert((values[0] == ArgumentValues{{"first", Value::integer(20)}, {"after", Value::string("y")}, {"n", Value::integer(1)}}));
+        assert(prepared->resolve(*second, {})[0][2].second == Value::integer(7));
+        assert(prepared->arguments->variable_values({}, prepared->literals(*second)).at("n") == Value::integer(7));
+
+        auto out_of_range = std::make_shared<TokenBuffer>(new Source("query Q($n: Int = 5) { users(first: 99999999999, after: \"x\", n: $n) { id ...F } }" + fragment));
+        assert(cache.prepare(out_of_range, "Q") == prepared);
+        assert(prepared->resolve(*out_of_range, {})[0][0].second == Value::integer(99999999999));
+
+        PlanCacheStats stats = cache.stats();
+        assert(stats.hits == 2 && stats.misses == 1 && stats.size == 1);
+        assert(stats.hit_rate() == 2.0 / 3);
+
+        // Operation names are part of the key, and the least recently used plan is evicted
+        assert_error([&]() { cache.prepare(first, "R"); }, "Unknown operation named \"R\".");
+        cache.prepare(std::make_shared<TokenBuffer>(new Source("{ a }")));
+        cache.prepare(first, "Q");
+        cache.prepare(std::make_shared<TokenBuffer>(new Source("{ b }")));
+        assert(cache.prepare(first, "Q") == prepared);
+        stats = cache.stats();
+        assert(stats.hits == 4 && stats.misses == 4 && stats.evictions == 1 && stats.size == 2);
+        assert(prepared->resolve(*first, {})[0][0].second == Value::integer(10));
+        cache.clear();
+        assert(cache.stats().size == 0 && cache.prepare(first, "Q") != prepared);
+
+        // Directive arguments are not rebound, so their literals are part of the key
+        auto few = std::make_shared<TokenBuffer>(new Source("{ users @stream(initialCount: 0) { id } }"));
+        auto many = std::make_shared<TokenBuffer>(new Source("{ users @stream(initialCount: 10) { id } }"));
+        std::shared_ptr<const PreparedOperation> streamed = cache.prepare(few);
+        assert(cache.prepare(many) != streamed);
+        assert(cache.prepare(many)->root->fields[0].nodes[0].node->directives[0]->arguments[0]->value->value == "10");
+        assert(cache.prepare(few) == streamed && streamed->root->fields[0].nodes[0].node->directives[0]->arguments[0]->value->value == "0");
+    }
+}
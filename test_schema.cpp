@@ -0,0 +1,190 @@
+#include "graphql-cpp.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+#include <fmt/core.h>
+
+using namespace graphql;
+
+void assert_error(std::function<void()> action, std::string message) {
+    try {
+        action();
+        assert(false);
+    } catch (const GraphQLError &e) {
+        assert(e.message == message);
+    }
+}
+
+void assert_schema_error(std::string sdl, std::string message) {
+    assert_error([&]() { compile_schema(new Source(sdl)); }, message);
+}
+
+std::vector<std::string> type_names(const Schema &schema, uint32_t first, uint32_t count) {
+    std::vector<std::string> names;
+    for (uint32_t member = first; member < first + count; member++)
+        names.emplace_back(schema.string(schema.type(schema.member(member)).name));
+    return names;
+}
+
+int main(int argc, char *argv[]) {
+    std::string sdl =
+        "schema { query: Root mutation: Change }\n"
+        "\"\"\"\n  The query root\n\"\"\"\n"
+        "type Root implements Node {\n"
+        "  id: ID!\n"
+        "  \"Look up users\" users(filter: Filter = {role: ADMIN, tags: [\"a\", \"b\"]}, first: Int = 10): [User!]!\n"
+        "  search(text: String!): [Result] @deprecated(reason: \"Use users\")\n"
+        "}\n"
+        "type Change { ping: Boolean @deprecated }\n"
+        "interface Node { id: ID! }\n"
+        "type User implements Node @key { id: ID! role: Role }\n"
+        "union Result = User\n"
+        "enum Role { ADMIN \"Read only\" GUEST @deprecated(reason: \"Gone\") }\n"
+        "input Filter { role: Role, tags: [String!] }\n"
+        "directive @key(fields: String = \"id\") repeatable on OBJECT | INTERFACE\n"
+        "extend type User { name: String }\n"
+        "extend union Result = Root\n"
+        "extend enum Role { OWNER }\n";
+
+    // Builds sorted schema tables with extensions merged and built-ins added
+    {
+        std::string bytes = compile_schema(new Source(sdl));
+        Schema schema = Schema::from_bytes(bytes);
+        assert(schema.size() == bytes.size());
+        std::vector<std::string> names;
+        for (uint32_t index = 0; index < schema.type_count(); index++)
+            names.emplace_back(schema.string(schema.type(index).name));
+        assert((names == std::vector<std::string>{"Boolean", "Change", "Filter", "Float", "ID", "Int", "Node", "Result", "Role", "Root", "String", "User"}));
+        assert(schema.find_type("Missing") == SNAPSHOT_NONE && schema.find_type("") == SNAPSHOT_NONE);
+
+        uint32_t root = schema.find_type("Root");
+        assert(schema.query_type() == root && schema.mutation_type() == schema.find_type("Change"));
+        assert(schema.subscription_type() == SNAPSHOT_NONE);
+        assert(schema.type(root).kind == OBJECT_TYPE && schema.string(schema.type(root).description) == "The query root");
+        assert(type_names(schema, schema.type(root).first_interface, schema.type(root).interface_count) == std::vector<std::string>{"Node"});
+
+        const SnapshotField &users = schema.field(schema.find_field(root, "users"));
+        assert(schema.string(users.description) == "Look up users" && schema.print_type_ref(users.type) == "[User!]!");
+        assert(users.argument_count == 2 && users.deprecation_reason == SNAPSHOT_NONE);
+        assert(schema.string(schema.input_value(users.first_argument).default_value) == "{role: ADMIN, tags: [\"a\", \"b\"]}");
+        assert(schema.string(schema.input_value(users.first_argument + 1).name) == "first");
+        assert(schema.string(schema.field(schema.find_field(root, "search")).deprecation_reason) == "Use users");
+        assert(schema.string(schema.field(schema.find_field(schema.mutation_type(), "ping")).deprecation_reason) == "No longer supported");
+        assert(schema.find_field(root, "missing") == SNAPSHOT_NONE && schema.find_field(schema.find_type("Role"), "ADMIN") == SNAPSHOT_NONE);
+
+        const SnapshotType &user = schema.type(schema.find_type("User"));
+        assert(user.field_count == 3 && schema.string(schema.field(user.first_field + 2).name) == "name");
+        const SnapshotType &role = schema.type(schema.find_type("Role"));
+        assert(role.kind == ENUM_TYPE && role.field_count == 3);
+        assert(schema.string(schema.enum_value(role.first_field + 1).description) == "Read only");
+        assert(schema.string(schema.enum_value(role.first_field + 1).deprecation_reason) == "Gone");
+        assert(schema.string(schema.enum_value(role.first_field + 2).name) == "OWNER");
+        const SnapshotType &filter = schema.type(schema.find_type("Filter"));
+        assert(filter.kind == INPUT_OBJECT_TYPE && schema.print_type_ref(schema.input_value(filter.first_field + 1).type) == "[String!]");
+
+        const SnapshotType &node = schema.type(schema.find_type("Node"));
+        assert((type_names(schema, node.first_possible_type, node.possible_type_count) == std::vector<std::string>{"Root", "User"}));
+        const SnapshotType &result = schema.type(schema.find_type("Result"));
+        assert((type_names(schema, result.first_possible_type, result.possible_type_count) == std::vector<std::string>{"User", "Root"}));
+        PossibleTypes possible_types = schema.possible_types();
+        assert(possible_types.size() == 2 && possible_types["Node"] == std::unordered_set<std::string>({"Root", "User"}));
+
+        const SnapshotDirective &key = schema.directive(schema.find_directive("key"));
+        assert(key.repeatable && key.locations == ((1u << 10) | (1u << 13)));
+        assert(schema.string(schema.input_value(key.first_argument).default_value) == "\"id\"");
+        assert(schema.find_directive("include") != SNAPSHOT_NONE && schema.find_directive("missing") == SNAPSHOT_NONE);
+
+        // Snapshots are deterministic and printing them gives SDL for the same snapshot
+        assert(compile_schema(new Source(sdl)) == bytes);
+        std::string printed = print_schema(schema);
+        assert(printed.rfind("schema {\n  query: Root\n  mutation: Change\n}\n\ndirective @key(fields: String = \"id\") repeatable on OBJECT | INTERFACE\n", 0) == 0);
+        assert(printed.find("\"The query root\"\ntype Root implements Node {\n  id: ID!\n  \"Look up users\"\n  users(") != std::string::npos);
+        assert(printed.find("  GUEST @deprecated(reason: \"Gone\")\n") != std::string::npos);
+        assert(printed.find("scalar") == std::string::npos);
+        assert(compile_schema(new Source(printed)) == bytes);
+
+        // Maps a written snapshot
+        std::string path = "test_schema.snapshot";
+        std::ofstream(path, std::ios::binary) << bytes;
+        Schema mapped = Schema::load(path);
+        std::remove(path.c_str());
+        assert(mapped.size() == bytes.size() && std::memcmp(mapped.data(), bytes.data(), bytes.size()) == 0);
+        assert(mapped.print_type_ref(mapped.field(mapped.find_field(mapped.query_type(), "search")).type) == "[Result]");
+
+        // Feeds the field planner and the plan cache
+        DocumentNode *document = parse(new Source("{ users { ... on Node { id } ... on User { name } } }"));
+        const FieldPlan *plan = document->field_planner(possible_types)->plan(document->get_operation()->selection_set, "Root");
+        assert(document->field_planner(possible_types)->plan(&plan->fields[0], "User")->fields.size() == 2);
+        delete document;
+        PlanCache cache(8, schema);
+        auto tokens = std::make_shared<TokenBuffer>(new Source("mutation { ping }"));
+        assert(cache.prepare(tokens)->root->type_name == "Change");
+
+        // Rejects snapshots that are damaged or from another version
+        assert_error([&]() { Schema::from_bytes(bytes.substr(0, 40)); }, "Invalid schema snapshot: unexpected size.");
+        assert_error([&]() { Schema::from_bytes(bytes.substr(0, bytes.size() - 1)); }, "Invalid schema snapshot: truncated.");
+        std::string damaged = bytes;
+        damaged[0] = 'X';
+        assert_error([&]() { Schema::from_bytes(damaged); }, "Invalid schema snapshot: bad magic number.");
+        damaged = bytes;
+        uint32_t version = SCHEMA_SNAPSHOT_VERSION + 1;
+        std::memcpy(&damaged[offsetof(SnapshotHeader, version)], &version, sizeof(version));
+        assert_error([&]() { Schema::from_bytes(damaged); }, fmt::format("Invalid schema snapshot: version {} is not supported, expected {}.", version, SCHEMA_SNAPSHOT_VERSION));
+        damaged = bytes;
+        const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(bytes.data());
+        uint32_t type_count = header->types.count;
+        std::memcpy(&damaged[header->members.offset], &type_count, sizeof(type_count));
+        assert_error([&]() { Schema::from_bytes(damaged); }, "Invalid schema snapshot: bad index.");
+        assert_error([&]() { Schema::load("missing.snapshot"); }, "Cannot open schema snapshot \"missing.snapshot\": No such file or directory.");
+    }
+
+    // Uses conventional root type names without a schema definition
+    {
+        Schema schema = Schema::from_bytes(compile_schema(new Source("type Query { a: Int } type Subscription { b: Int }")));
+        assert(schema.query_type() == schema.find_type("Query") && schema.subscription_type() == schema.find_type("Subscription"));
+        assert(schema.mutation_type() == SNAPSHOT_NONE);
+        assert(print_schema(schema) == "type Query {\n  a: Int\n}\n\ntype Subscription {\n  b: Int\n}\n");
+    }
+
+    // Keeps deprecated arguments and input fields, empty reasons and @specifiedBy URLs
+    {
+        std::string deprecations =
+            "scalar Date @specifiedBy(url: \"https://example.com/date\")\n\n"
+            "input Filter {\n  since: Date @deprecated\n  tag: String\n}\n\n"
+            "type Query {\n  events(first: Int @deprecated(reason: \"Use last\"), last: Int, filter: Filter): [Date] @deprecated(reason: \"\")\n}\n";
+        std::string bytes = compile_schema(new Source(deprecations));
+        Schema schema = Schema::from_bytes(bytes);
+        assert(schema.string(schema.type(schema.find_type("Date")).specified_by_url) == "https://example.com/date");
+        assert(schema.type(schema.find_type("String")).specified_by_url == SNAPSHOT_NONE);
+        const SnapshotField &events = schema.field(schema.find_field(schema.query_type(), "events"));
+        assert(events.deprecation_reason != SNAPSHOT_NONE && schema.string(events.deprecation_reason).empty());
+        assert(schema.string(schema.input_value(events.first_argument).deprecation_reason) == "Use last");
+        assert(schema.input_value(events.first_argument + 1).deprecation_reason == SNAPSHOT_NONE);
+        const SnapshotType &filter = schema.type(schema.find_type("Filter"));
+        assert(schema.string(schema.input_value(filter.first_field).deprecation_reason) == "No longer supported");
+        assert(print_schema(schema) == deprecations);
+        assert(compile_schema(new Source(print_schema(schema))) == bytes);
+    }
+
+    // Reports definitions that do not form a schema
+    assert_schema_error("type Query { a: Missing }", "Unknown type \"Missing\".");
+    assert_schema_error("schema { query: Missing }", "Unknown type \"Missing\".");
+    assert_schema_error("type A { a: Int } type A { b: Int }", "There can be only one type named \"A\".");
+    assert_schema_error("directive @a on FIELD directive @a on OBJECT", "There can be only one directive named \"@a\".");
+    assert_schema_error("extend type A { a: Int }", "Cannot extend type \"A\" because it is not defined.");
+    assert_schema_error("type A { a: Int } extend input A { b: Int }", "Cannot extend non-object type \"A\".");
+    assert_schema_error("schema { query: A } schema { query: A } type A { a: Int }", "Must provide only one schema definition.");
+    assert_schema_error("type Q { a: Int a: String }", "Field \"Q.a\" can only be defined once.");
+    assert_schema_error("type Q { a: Int } extend type Q { a: String }", "Field \"Q.a\" can only be defined once.");
+    assert_schema_error("input F { a: Int a: Int }", "Field \"F.a\" can only be defined once.");
+    assert_schema_error("enum E { A B } extend enum E { A }", "Enum value \"E.A\" can only be defined once.");
+    assert_schema_error("type Q { a: [F!] } input F { b: Int }", "The type of Q.a must be Output Type but got: [F!].");
+    assert_schema_error("type Q { a(b: Q): Int }", "The type of Q.a(b:) must be Input Type but got: Q.");
+    assert_schema_error("type Q { a: Int } input F { b: Q }", "The type of F.b must be Input Type but got: Q.");
+    assert_schema_error("type Q { a: Int } directive @d(b: [Q]) on FIELD", "The type of @d(b:) must be Input Type but got: [Q].");
+    assert_error([]() { compile_schema(new Source("type A { a: Int")); }, "Syntax Error: Expected Name, found <EOF>.");
+}